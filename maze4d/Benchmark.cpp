@@ -0,0 +1,132 @@
+/*-----------------------------------------------------------------------------
+
+ Offline benchmark of the maze generation and the CPU raycasting
+ (no window or OpenGL context needed).
+
+ Usage: maze4d_benchmark [max_exponent] [raycast_maze_side]
+   Generates 4D mazes of ~10^4 .. 10^max_exponent rooms (default 8)
+   and reports generation speed in rooms per second, for the single-threaded,
+   the parallel (all CPU cores) and the streaming generators.
+   Then renders the field of raycast_maze_side^4 rooms (default 6) from random
+   cameras by Raycaster::FindPixel for each cell layout, and reports rays per second.
+
+-----------------------------------------------------------------------------*/
+
+#include <chrono>
+#include <random>
+
+#include <Raycaster.h>
+
+static void BenchmarkMaze(int exponent, int algorithm)
+{
+	// Hypercube maze with roughly 10^exponent rooms
+	int side = (int)round(std::pow(10.0, exponent / 4.0));
+	glm::ivec4 size(side, side, side, side);
+	int64_t rooms = int64_t(size.x) * size.y * size.z * size.w;
+
+	Random::GetInstance()->Init(1);
+	Maze maze(size);
+
+	auto start = std::chrono::steady_clock::now();
+	if (algorithm == MAZE_ALGORITHM_PARALLEL)
+	{
+		maze.GenerateParallel(0);
+	}
+	else if (algorithm == MAZE_ALGORITHM_STREAM)
+	{
+		maze.BeginStream(2);
+		for (int x = 0; x < size.x; x++)
+			maze.NextSlab();
+	}
+	else
+	{
+		maze.Generate();
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	double seconds = std::chrono::duration<double>(end - start).count();
+	static const char* names[] = { "dfs      ", "parallel ", "stream   " };
+	Log(names[algorithm], "maze ", side, "^4 (", rooms, " rooms): ", seconds, " s, ", rooms / seconds, " rooms/s");
+}
+
+static void BenchmarkRaycast(int side, int layout, bool skipEmptySpace)
+{
+	const int roomSize = 8;
+	const int cameras = 200;
+	const int viewSize = 128;
+
+	glm::ivec4 mazeSize(side, side, side, side);
+	Random::GetInstance()->Init(1);
+	Maze maze(mazeSize);
+	maze.Generate();
+	Field field(mazeSize * roomSize + 1, 18, roomSize, layout);
+	field.Generate(&maze);
+	Raycaster raycaster;
+	raycaster.Init(&field);
+	raycaster.skipEmptySpace = skipEmptySpace;
+
+	// The same cameras for every layout: random empty cube and random orientation
+	std::mt19937 engine(1);
+	std::uniform_real_distribution<float> random(-1.0f, 1.0f);
+	auto randomVector = [&]() { return glm::vec4(random(engine), random(engine), random(engine), random(engine)); };
+
+	int64_t rays = 0;
+	int64_t steps = 0;
+	uint64_t checksum = 0;
+	double seconds = 0.0;
+	for (int c = 0; c < cameras; c++)
+	{
+		glm::vec4 pos;
+		do
+		{
+			pos = (randomVector() * 0.5f + 0.5f) * glm::vec4(field.size - 1);
+		} while ((field.GetCube(int(pos.x), int(pos.y), int(pos.z), int(pos.w)) & WALL_BLOCK) != 0);
+
+		// Orthonormal view vectors as the player has
+		glm::vec4 v[3];
+		for (int i = 0; i < 3; i++)
+		{
+			v[i] = randomVector();
+			for (int j = 0; j < i; j++)
+				v[i] -= v[j] * glm::dot(v[i], v[j]);
+			v[i] = glm::normalize(v[i]);
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		for (int y = 0; y < viewSize; y++)
+			for (int x = 0; x < viewSize; x++)
+			{
+				glm::vec4 ray = v[0] + v[1] * (float(y - viewSize / 2) / (viewSize / 2)) + v[2] * (float(x - viewSize / 2) / (viewSize / 2));
+				glm::u8vec3 pixel(0, 0, 0);
+				float dist;
+				steps += raycaster.FindPixel(pos, ray, pixel, dist);
+				checksum = checksum * 31 + pixel.x + pixel.y + pixel.z;
+			}
+		seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		rays += viewSize * viewSize;
+	}
+
+	static const char* names[] = { "tiled    ", "morton   " };
+	Log(names[layout], "raycast ", side, "^4 rooms", skipEmptySpace ? "" : " without skipping", ": ", rays / seconds, " rays/s, ",
+		double(steps) / rays, " steps/ray (checksum ", checksum, ")");
+}
+
+int main(int argc, char** argv)
+{
+	int maxExponent = argc > 1 ? std::atoi(argv[1]) : 8;
+	int raycastSide = argc > 2 ? std::atoi(argv[2]) : 6;
+
+	for (int exponent = 4; exponent <= maxExponent; exponent++)
+	{
+		BenchmarkMaze(exponent, MAZE_ALGORITHM_DFS);
+		BenchmarkMaze(exponent, MAZE_ALGORITHM_PARALLEL);
+		BenchmarkMaze(exponent, MAZE_ALGORITHM_STREAM);
+	}
+
+	Cube::InitTextures();
+	BenchmarkRaycast(raycastSide, BRICK_LAYOUT_TILED, false);
+	BenchmarkRaycast(raycastSide, BRICK_LAYOUT_TILED, true);
+	BenchmarkRaycast(raycastSide, BRICK_LAYOUT_MORTON, true);
+
+	return 0;
+}
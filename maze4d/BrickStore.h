@@ -0,0 +1,226 @@
+#pragma once
+
+#include <Utils.h>
+
+#include <algorithm>
+
+// Brick is 4x4x4x4 cells. Walls go every roomSize (8 by default) cells on each axis,
+// so a bigger brick would almost never lie inside the room interior.
+#define BRICK_BITS 2
+#define BRICK_SIZE (1 << BRICK_BITS)
+#define BRICK_MASK (BRICK_SIZE - 1)
+#define BRICK_CELLS_BITS (4 * BRICK_BITS)
+#define BRICK_CELLS (1 << BRICK_CELLS_BITS)
+
+// Order of the bricks and of the cells inside a brick.
+// Tiled: x, y, z, w order (w is the fastest).
+// Morton (Z-order): bits of x, y, z and w are interleaved, so the neighbours along every axis
+// are close in memory. The brick table is padded to powers of two.
+#define BRICK_LAYOUT_TILED 0
+#define BRICK_LAYOUT_MORTON 1
+
+// Sparse 4D array of cells, split into bricks. Brick without payload has the same value in all
+// its cells (e.g. empty room interior or solid wall), so it takes no memory besides the table.
+// Index is 64-bit: (brick index << BRICK_CELLS_BITS) | cell index inside the brick.
+// Each axis has its own bits in the index, so the index is a sum of per-axis parts
+// and a step along one axis only replaces its part (see MoveIndex).
+template <typename T>
+class BrickStore
+{
+public:
+	BrickStore(const glm::ivec4 size, const int layout = BRICK_LAYOUT_TILED) : size(size), layout(layout)
+	{
+		bricksCount = (size + BRICK_MASK) >> BRICK_BITS;
+		totalBricks = InitAxisIndices();
+
+		bricks = new T*[totalBricks];
+		uniformValues = new T[totalBricks];
+		for (int64_t b = 0; b < totalBricks; b++)
+		{
+			bricks[b] = nullptr;
+			uniformValues[b] = 0;
+		}
+	}
+
+	~BrickStore()
+	{
+		for (int64_t b = 0; b < totalBricks; b++)
+			delete[] bricks[b];
+		delete[] bricks;
+		delete[] uniformValues;
+		for (int axis = 0; axis < 4; axis++)
+			delete[] axisIndices[axis];
+	}
+
+	int64_t GetIndex(const int x, const int y, const int z, const int w) const
+	{
+		return axisIndices[0][x] + axisIndices[1][y] + axisIndices[2][z] + axisIndices[3][w];
+	}
+
+	// Index of the cell moved along the axis from the coordinate "from" to "to"
+	int64_t MoveIndex(const int64_t index, const int axis, const int from, const int to) const
+	{
+		return index - axisIndices[axis][from] + axisIndices[axis][to];
+	}
+
+	T Get(const int64_t index) const
+	{
+		const T* payload = bricks[index >> BRICK_CELLS_BITS];
+		return payload != nullptr ? payload[index & (BRICK_CELLS - 1)] : uniformValues[index >> BRICK_CELLS_BITS];
+	}
+
+	void Set(const int64_t index, const T value)
+	{
+		int64_t brick = index >> BRICK_CELLS_BITS;
+		if (bricks[brick] == nullptr && uniformValues[brick] == value)
+			return;
+		Ref(index) = value;
+	}
+
+	// Allocates the brick payload if needed, so only use it for writing
+	T& Ref(const int64_t index)
+	{
+		int64_t brick = index >> BRICK_CELLS_BITS;
+		if (bricks[brick] == nullptr)
+		{
+			bricks[brick] = new T[BRICK_CELLS];
+			for (int i = 0; i < BRICK_CELLS; i++)
+				bricks[brick][i] = uniformValues[brick];
+		}
+		return bricks[brick][index & (BRICK_CELLS - 1)];
+	}
+
+	void Fill(const T value)
+	{
+		for (int64_t b = 0; b < totalBricks; b++)
+		{
+			delete[] bricks[b];
+			bricks[b] = nullptr;
+			uniformValues[b] = value;
+		}
+	}
+
+	// Frees payloads of the bricks with the same value in all cells
+	void Compact()
+	{
+		for (int64_t b = 0; b < totalBricks; b++)
+		{
+			T* payload = bricks[b];
+			if (payload == nullptr)
+				continue;
+
+			int i = 1;
+			while (i < BRICK_CELLS && payload[i] == payload[0])
+				i++;
+			if (i == BRICK_CELLS)
+			{
+				uniformValues[b] = payload[0];
+				delete[] payload;
+				bricks[b] = nullptr;
+			}
+		}
+	}
+
+	int64_t GetBricksCount() const { return totalBricks; }
+
+	// Brick payload, nullptr for the brick with the same value in all cells
+	const T* GetPayload(const int64_t brick) const { return bricks[brick]; }
+	T GetUniformValue(const int64_t brick) const { return uniformValues[brick]; }
+
+	// Sets the brick to the copy of the payload, or to the uniform value if the payload is nullptr
+	void SetBrick(const int64_t brick, const T* payload, const T uniformValue)
+	{
+		uniformValues[brick] = uniformValue;
+		if (payload == nullptr)
+		{
+			delete[] bricks[brick];
+			bricks[brick] = nullptr;
+			return;
+		}
+
+		if (bricks[brick] == nullptr)
+			bricks[brick] = new T[BRICK_CELLS];
+		std::copy(payload, payload + BRICK_CELLS, bricks[brick]);
+	}
+
+	int64_t GetMemoryBytes() const
+	{
+		int64_t bytes = totalBricks * (sizeof(T*) + sizeof(T));
+		for (int64_t b = 0; b < totalBricks; b++)
+			if (bricks[b] != nullptr)
+				bytes += BRICK_CELLS * sizeof(T);
+		return bytes;
+	}
+
+	const glm::ivec4 size;
+	const int layout;
+
+private:
+	// Fills axisIndices for the layout, returns the size of the brick table
+	int64_t InitAxisIndices()
+	{
+		// Index bit of each coordinate bit: brickBits[axis][bit] for the brick coordinate
+		// and cellBits[axis][bit] for the coordinate inside the brick
+		int brickBits[4][32];
+		int cellBits[4][BRICK_BITS];
+		int bricksBits = 0;
+		if (layout == BRICK_LAYOUT_MORTON)
+		{
+			glm::ivec4 axisBits(0);
+			for (int axis = 0; axis < 4; axis++)
+				while ((1 << axisBits[axis]) < bricksCount[axis])
+					axisBits[axis]++;
+
+			// Interleave while the axes have bits left, w is the lowest as in the tiled layout
+			for (int bit = 0; bit < 32; bit++)
+				for (int axis = 3; axis >= 0; axis--)
+					if (bit < axisBits[axis])
+						brickBits[axis][bit] = bricksBits++;
+			for (int bit = 0; bit < BRICK_BITS; bit++)
+				for (int axis = 0; axis < 4; axis++)
+					cellBits[axis][bit] = bit * 4 + 3 - axis;
+		}
+		else
+		{
+			for (int axis = 0; axis < 4; axis++)
+				for (int bit = 0; bit < BRICK_BITS; bit++)
+					cellBits[axis][bit] = (3 - axis) * BRICK_BITS + bit;
+		}
+
+		int64_t stride = 1;
+		for (int axis = 3; axis >= 0; axis--)
+		{
+			axisIndices[axis] = new int64_t[size[axis]];
+			for (int c = 0; c < size[axis]; c++)
+			{
+				int64_t brick = 0;
+				int cell = 0;
+				if (layout == BRICK_LAYOUT_MORTON)
+				{
+					for (int bit = 0; (c >> BRICK_BITS) >> bit != 0; bit++)
+						brick |= int64_t(((c >> BRICK_BITS) >> bit) & 1) << brickBits[axis][bit];
+				}
+				else
+				{
+					brick = (c >> BRICK_BITS) * stride;
+				}
+				for (int bit = 0; bit < BRICK_BITS; bit++)
+					cell |= ((c >> bit) & 1) << cellBits[axis][bit];
+				axisIndices[axis][c] = (brick << BRICK_CELLS_BITS) | cell;
+			}
+			stride *= bricksCount[axis];
+		}
+
+		return layout == BRICK_LAYOUT_MORTON ? int64_t(1) << bricksBits : stride;
+	}
+
+	glm::ivec4 bricksCount;
+	int64_t totalBricks;
+
+	// Part of the index for each coordinate of each axis
+	int64_t* axisIndices[4];
+
+	// Indirection table: brick payload or nullptr for the uniform brick
+	T** bricks;
+	T* uniformValues;
+};
@@ -343,17 +343,30 @@ private:
 		{ "maze_size_w",{ "game", CFG_TYPE_INT,   "3", " # Number of w-rooms" } },
 		{ "maze_room_size",{ "advanced", CFG_TYPE_INT,   "8", "# Number of cubes in each maze room axis" } },
 		{ "light_dist",{ "advanced", CFG_TYPE_INT,  "18", " # Number of cubes which light can pass before ends" } },
+		{ "maze_algorithm",{ "advanced", CFG_TYPE_INT,  "0", " # 0 - depth-first; 1 - parallel depth-first (same seed and threads give the same maze); 2 - streaming (Eller's), keeps only a few layers of rooms in memory" } },
+		{ "maze_threads",{ "advanced", CFG_TYPE_INT,  "0", " # Threads for the parallel maze generation; 0 - number of CPU cores" } },
+		{ "cell_layout",{ "advanced", CFG_TYPE_INT,  "0", " # Order of the cubes in memory: 0 - 4x4x4x4 bricks in x, y, z, w order; 1 - Morton (Z-order)" } },
+		{ "world_cache",{ "advanced", CFG_TYPE_BOOL,  "1", " # 0 - disable; 1 - save the generated world to a file and load it next time with the same seed and settings" } },
+		{ "gpu_profile_csv",{ "advanced", CFG_TYPE_BOOL,  "0", " # 0 - disable; 1 - write the GPU time of the render passes to gpu_profile.csv every second" } },
+		{ "shader_cache",{ "advanced", CFG_TYPE_BOOL,  "1", " # 0 - disable; 1 - save the linked shaders to files and load them next time with the same shaders and video driver" } },
 		{ "speed",{ "controls", CFG_TYPE_FLOAT, "5.0", " # Player speed during movement" } },
 		{ "mouse_sens",{ "controls", CFG_TYPE_FLOAT, "1.0", " # Speed of camera rotation" } },
 		{ "seed",{ "game", CFG_TYPE_INT,  "-1", " # set -1 to use random seed" } },
 		{ "multithreading",{ "video", CFG_TYPE_BOOL,   "0", " #  (CPU RENDERING) 0 - disable; 1 - enable. WARNING: CPU usage can reach 100%" } },
 		{ "skip_pixels",{ "video", CFG_TYPE_BOOL,   "0", "  # (CPU RENDERING) set 1 to render all pixels each frame; 0 to render only half" } },
 		{ "anti_aliasing",{ "video", CFG_TYPE_INT,   "1", "  # (GPU RENDERING) 0 - x1; 1 - x4; 2 - x9" } },
+		{ "adaptive_aa",{ "video", CFG_TYPE_BOOL,   "1", "  # (GPU RENDERING) 1 - anti-aliasing samples only for the pixels on the cube edges; 0 - for all pixels" } },
+		{ "temporal_aa",{ "video", CFG_TYPE_BOOL,   "0", "  # (GPU RENDERING) 1 - one ray per pixel, moved inside the pixel every frame and blended with the previous frames, instead of anti_aliasing; 0 - disable" } },
+		{ "dynamic_resolution",{ "video", CFG_TYPE_BOOL,   "0", "  # (GPU RENDERING) 1 - the scene is rendered in the resolution, which holds target_frame_ms, and is upscaled to the window; 0 - in the window resolution" } },
+		{ "target_frame_ms",{ "video", CFG_TYPE_FLOAT,   "8.3", "  # (DYNAMIC RESOLUTION) Frame time to hold, in milliseconds" } },
+		{ "min_resolution_scale",{ "video", CFG_TYPE_FLOAT,   "0.5", "  # (DYNAMIC RESOLUTION) Lowest scene resolution relative to the window, 0.0625 - 2.0" } },
+		{ "max_resolution_scale",{ "video", CFG_TYPE_FLOAT,   "1.0", "  # (DYNAMIC RESOLUTION) Highest scene resolution relative to the window, above 1.0 is supersampling" } },
 		{ "vsync",{ "video", CFG_TYPE_BOOL,   "0", " # 0 - disable; 1 - enable" } },		
 		{ "ground_rotation",{ "controls", CFG_TYPE_BOOL,   "0", " # Shooter-like camera positioning like ground-graviation" } },
 		{ "display_coords",{ "controls", CFG_TYPE_BOOL,   "0", " # 0 - disable; 1 - enable. Displays maze coordinates." } },
 		{ "show_w-rearviews",{ "controls", CFG_TYPE_BOOL,   "1", " # Displays 2 small windows with camera rotated 90 degrees in YW and ZW angles" } },
 		{ "cpu_render",{ "advanced", CFG_TYPE_INT,   "0", " # 0 - GPU render; 1 - CPU render; 2 - 50/50: left half of the screen is GPU-based, right-half is CPU" } },
+		{ "gpu_raycaster",{ "advanced", CFG_TYPE_INT,   "0", " # (GPU RENDERING) 0 - fragment shader; 1 - compute shader in 8x8 tiles, needs OpenGL 4.3, otherwise 0 is used" } },
 		{ "texture_smoothering",{ "advanced", CFG_TYPE_BOOL,   "0", " # 0 - Pixel art; 1 - linear smoothering" } },
 		{ "cube_pixels",{ "advanced", CFG_TYPE_INT,   "16", " # Number of pixels in one cube side texure" } },
 		{ "border_pixels",{ "advanced", CFG_TYPE_INT,   "1", " # Number of pixels that are darkened to emphasize borders" } }
@@ -4,6 +4,30 @@
 Cube::TextureSet_t Cube::textureSet;
 
 void Cube::Init(Shader* shader)
+{
+	InitTextures();
+
+	LoadToGL(shader);
+	LoadLightTextureToGL(shader);
+}
+
+// The light levels are stacked along z, so the depth TEX_SIZE*LIGHT_GRAD of the edge textures
+// must not exceed GL_MAX_3D_TEXTURE_SIZE, which is only 256 on GL 3.3
+int Cube::GetTexSize(int cubePixels)
+{
+	GLint max3dTextureSize = 0;
+	glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max3dTextureSize);
+	int maxTexSize = max3dTextureSize / Texture::LIGHT_GRAD;
+	if (cubePixels > maxTexSize)
+	{
+		Log("cube_pixels ", cubePixels, " is too big: the edge textures need the depth ", cubePixels * Texture::LIGHT_GRAD,
+			", GL_MAX_3D_TEXTURE_SIZE is ", max3dTextureSize, ", cube_pixels ", maxTexSize, " is used");
+		return maxTexSize;
+	}
+	return cubePixels;
+}
+
+void Cube::InitTextures()
 {
 	textureSet[NEG_X].Init(glm::ivec3(351, 86, 80)); // red
 	textureSet[POS_X].Init(glm::ivec3( 32, 86, 80)); // orange
@@ -13,18 +37,17 @@ void Cube::Init(Shader* shader)
 	textureSet[POS_Z].Init(glm::ivec3(245, 86, 80)); // blue
 	textureSet[NEG_W].Init(glm::ivec3(282, 86, 80)); // purple
 	textureSet[POS_W].Init(glm::ivec3(  0,  0, 60)); // gray
-
-	LoadToGL(shader);
-	LoadLightTextureToGL(shader);
 }
 
 void Cube::LoadToGL(Shader* shader)
 {
 	//return;
-	GLsizei size = Texture::TEX_SIZE*Texture::TEX_SIZE*Texture::TEX_SIZE;
+	// The light levels of the CPU render are baked in: the cube of the level l is the z slab l,
+	// so the shader lights the pixel with the same fetch and gets the same color as the CPU render
+	GLsizei size = Texture::TEX_SIZE*Texture::TEX_SIZE*Texture::TEX_SIZE*Texture::LIGHT_GRAD;
 	int width = Texture::TEX_SIZE;
 	int height = Texture::TEX_SIZE;
-	int depth = Texture::TEX_SIZE;
+	int depth = Texture::TEX_SIZE*Texture::LIGHT_GRAD;
 
 
 	auto GetIndex = [&](int x, int y, int z)
@@ -43,17 +66,18 @@ void Cube::LoadToGL(Shader* shader)
 		uint8_t* buf = new uint8_t[size * 4];
 
 
-		for (int x = 0; x < Texture::TEX_SIZE; x++)
-			for (int y = 0; y < Texture::TEX_SIZE; y++)
-				for (int z = 0; z < Texture::TEX_SIZE; z++)
-				{
-					int idx = GetIndex(x, y, z);
-					glm::uvec3 pixel = textureSet[edge].TexByIndex(x, y, z, 15);
-					buf[idx + 0] = pixel.x;// pixel.x; //Red
-					buf[idx + 1] = pixel.y; //Green
-					buf[idx + 2] = pixel.z; //Blue
-					buf[idx + 3] = 255; //Alpha
-				}
+		for (int l = 0; l < Texture::LIGHT_GRAD; l++)
+			for (int x = 0; x < Texture::TEX_SIZE; x++)
+				for (int y = 0; y < Texture::TEX_SIZE; y++)
+					for (int z = 0; z < Texture::TEX_SIZE; z++)
+					{
+						int idx = GetIndex(x, y, l * Texture::TEX_SIZE + z);
+						glm::uvec3 pixel = textureSet[edge].TexByIndex(x, y, z, l);
+						buf[idx + 0] = pixel.x;// pixel.x; //Red
+						buf[idx + 1] = pixel.y; //Green
+						buf[idx + 2] = pixel.z; //Blue
+						buf[idx + 3] = 255; //Alpha
+					}
 
 		EdgeTextureUnits[edge] = 50 + edge;
 		glActiveTexture(GL_TEXTURE0 + EdgeTextureUnits[edge]);
@@ -69,7 +93,10 @@ void Cube::LoadToGL(Shader* shader)
 		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, smootheringParam); //GL_LINEAR GL_NEAREST
 		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, smootheringParam);
 
-		glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, Texture::TEX_SIZE, Texture::TEX_SIZE, Texture::TEX_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, buf);
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, width, height, depth, 0, GL_RGBA, GL_UNSIGNED_BYTE, buf);
+		// The walls are black without the texture
+		if (glGetError() == GL_OUT_OF_MEMORY)
+			Log("Not enough GPU memory for the edge textures, please decrease cube_pixels");
 
 		delete[] buf;
 	}
@@ -77,9 +104,8 @@ void Cube::LoadToGL(Shader* shader)
 	//for (int i=0;i<8;i++) EdgeTextureIds[i] = 50;
 
 	unsigned int max = GL_MAX_TEXTURE_BUFFER_SIZE;
-	glUseProgram(shader->ID);
-	GLint variableId = glGetUniformLocation(shader->ID, "edge3dCube");
-	glUniform1iv(variableId, 8, EdgeTextureUnits); // Texture unit 4 is for current map.
+	shader->use();
+	shader->setIntArray(UNIFORM_EDGE_3D_CUBE, 8, EdgeTextureUnits); // Texture units 50-57 are for the edges.
 
 }
 
@@ -147,9 +173,8 @@ void Cube::LoadLightTextureToGL(Shader* shader)
 	glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, Texture::TEX_SIZE, Texture::TEX_SIZE, Texture::TEX_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, buf);
 
 
-	glUseProgram(shader->ID);
-	GLint variableId = glGetUniformLocation(shader->ID, "light3dCube");
-	glUniform1i(variableId, LightTextureUnit); // Texture unit 4 is for current map.
+	shader->use();
+	shader->setInt(UNIFORM_LIGHT_3D_CUBE, LightTextureUnit); // Texture unit 59 is for the light cube.
 }
 
 
@@ -200,9 +225,11 @@ void Cube::GetPixel(int edgeNum, glm::u8vec3& pixel, glm::vec3 texCoord,
 		break;
 	}
 
-	int x = int(texCoord[0] * Texture::TEX_SIZE);
-	int y = int(texCoord[1] * Texture::TEX_SIZE);
-	int z = int(texCoord[2] * Texture::TEX_SIZE);
+	// The texture repeats as the GL_REPEAT one of the GPU render: the hit point may be
+	// a rounding error outside of the cube
+	int x = WrapTexel(int(glm::floor(texCoord[0] * Texture::TEX_SIZE)));
+	int y = WrapTexel(int(glm::floor(texCoord[1] * Texture::TEX_SIZE)));
+	int z = WrapTexel(int(glm::floor(texCoord[2] * Texture::TEX_SIZE)));
 	pixel = textureSet[edgeNum].TexByIndex(x, y, z, lightLevel);
 
 	//Add border to light cell
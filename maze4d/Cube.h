@@ -12,6 +12,10 @@ public:
 	Cube() {}
 
 	static void Init(Shader* shader);
+	// cube_pixels, which fits into the edge textures
+	static int GetTexSize(int cubePixels);
+	// Textures for the CPU render only
+	static void InitTextures();
 	static void LoadToGL(Shader* shader);
 	static void LoadLightTextureToGL(Shader* shader);
 
@@ -19,6 +23,12 @@ public:
 		int& px, int& py, int& pz, int& pw, Cell_t& cell, Light_t& light);
 
 private:
+	static int WrapTexel(int texel)
+	{
+		texel %= Texture::TEX_SIZE;
+		return texel < 0 ? texel + Texture::TEX_SIZE : texel;
+	}
+
 	typedef std::array<Texture, EDGES_COUNT> TextureSet_t;
 	static TextureSet_t textureSet;
 };
\ No newline at end of file
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GameGraphics.h>
+#include <Utils.h>
+
+// The frame time is read from the query of FRAME_TIME_QUERIES frames ago, which has surely finished,
+// so the measurement never waits for the GPU
+#define FRAME_TIME_QUERIES 4
+// The scale changes in these steps: every new size reallocates the target and the images of the raycaster
+#define RESOLUTION_SCALE_STEP 0.0625f
+
+// Offscreen target of the scenes, whose resolution follows the frame time target.
+// The scenes are rendered between Begin and End, End draws the target upscaled to the viewport.
+// The frame time is the longer of the GPU time of the scenes (timer query) and the CPU time between Begin and End,
+// which includes the waits for the GPU. The cost of the frame is taken proportional to its pixels, i.e. to the scale squared.
+class DynamicResolution
+{
+public:
+	DynamicResolution(float targetMs, float minScale, float maxScale)
+	{
+		this->targetMs = glm::max(targetMs, 1.0f);
+		this->minScale = glm::clamp(minScale, RESOLUTION_SCALE_STEP, 2.0f);
+		this->maxScale = glm::clamp(maxScale, this->minScale, 2.0f);
+		scale = this->maxScale;
+
+		glGenFramebuffers(1, &framebuffer);
+		glGenTextures(1, &colorTex);
+		glBindTexture(GL_TEXTURE_2D, colorTex);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glGenQueries(FRAME_TIME_QUERIES, queries);
+	}
+
+	~DynamicResolution()
+	{
+		// The target may outlive the GL context (e.g. on exit)
+		if (glfwGetCurrentContext() == nullptr)
+			return;
+
+		glDeleteQueries(FRAME_TIME_QUERIES, queries);
+		glDeleteTextures(1, &colorTex);
+		glDeleteFramebuffers(1, &framebuffer);
+	}
+
+	// Binds the target of the scaled viewport size, false if it can't be used: then the scenes go to the window
+	bool Begin()
+	{
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &windowFramebuffer);
+		int width = glm::max(int(viewport[2] * scale + 0.5f), 1);
+		int height = glm::max(int(viewport[3] * scale + 0.5f), 1);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		if (width != targetWidth || height != targetHeight)
+		{
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, colorTex);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTex, 0);
+			targetWidth = width;
+			targetHeight = height;
+			isComplete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+			if (!isComplete)
+				Log("Offscreen target ", width, "x", height, " is not supported, the scene is rendered to the window");
+		}
+		if (!isComplete)
+		{
+			glBindFramebuffer(GL_FRAMEBUFFER, windowFramebuffer);
+			return false;
+		}
+
+		glViewport(0, 0, width, height);
+		glClear(GL_COLOR_BUFFER_BIT);
+
+		glBeginQuery(GL_TIME_ELAPSED, queries[frame % FRAME_TIME_QUERIES]);
+		beginTime = glfwGetTime();
+		return true;
+	}
+
+	// Measures the frame, binds the window back and draws the target over its viewport with the screen quad
+	void End(GameGraphics* screen)
+	{
+		double cpuMs = (glfwGetTime() - beginTime) * 1000.0;
+		glEndQuery(GL_TIME_ELAPSED);
+		frame++;
+
+		glBindFramebuffer(GL_FRAMEBUFFER, windowFramebuffer);
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+		// The target already has the blended scenes: it replaces the pixels
+		glDisable(GL_BLEND);
+		screen->Draw(colorTex);
+		glEnable(GL_BLEND);
+
+		double gpuMs = 0.0;
+		if (frame >= FRAME_TIME_QUERIES)
+		{
+			GLuint query = queries[frame % FRAME_TIME_QUERIES];
+			GLint isAvailable = 0;
+			glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &isAvailable);
+			if (isAvailable)
+			{
+				GLuint64 ns = 0;
+				glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+				gpuMs = ns / 1000000.0;
+			}
+		}
+		UpdateScale(glm::max(cpuMs, gpuMs));
+	}
+
+	float GetScale() const { return scale; }
+	float GetFrameMs() const { return float(frameMs); }
+
+private:
+	void UpdateScale(double ms)
+	{
+		// The average over ~10 frames: the cost of a single frame jumps with the view
+		frameMs = frameMs <= 0.0 ? ms : frameMs + (ms - frameMs) * 0.1;
+
+		// Goes down as soon as the frame is over the target, up only when the next step holds it
+		float wanted = scale * float(glm::sqrt(targetMs / frameMs));
+		float newScale = glm::clamp(glm::floor(wanted / RESOLUTION_SCALE_STEP) * RESOLUTION_SCALE_STEP, minScale, maxScale);
+		if (newScale == scale)
+			return;
+
+		// The average was measured with the old scale
+		frameMs *= (newScale * newScale) / (scale * scale);
+		scale = newScale;
+	}
+
+	float targetMs;
+	float minScale;
+	float maxScale;
+	float scale;
+	double frameMs = 0.0;
+
+	GLuint framebuffer = 0;
+	GLuint colorTex = 0;
+	int targetWidth = 0;
+	int targetHeight = 0;
+	bool isComplete = false;
+	// Framebuffer and viewport of the window, which the target is drawn to
+	GLint windowFramebuffer = 0;
+	GLint viewport[4];
+
+	GLuint queries[FRAME_TIME_QUERIES];
+	int frame = 0;
+	double beginTime = 0.0;
+};
@@ -1,52 +1,211 @@
 #include <Field.h>
 
-Field::Field(const glm::ivec4 size, const int lightDist, const int roomSize)
-	: size(size), totalSize(size.x*size.y*size.z*size.w), lightDist(lightDist), roomSize(roomSize)
+Field::Field(const glm::ivec4 size, const int lightDist, const int roomSize, const int layout)
+	: size(size), totalSize(int64_t(size.x)*size.y*size.z*size.w), lightDist(lightDist), roomSize(roomSize),
+	distanceMax(glm::clamp(roomSize / 2, 1, MAP_TEXEL_REGULAR - 1))
 {
-	map = new Cell_t[totalSize];
-	lightMap = new Light_t[totalSize];
-	winMap = new Cell_t[winMapSize.x*winMapSize.y*winMapSize.z*winMapSize.w];
-	winLightMap = new Light_t[winMapSize.x*winMapSize.y*winMapSize.z*winMapSize.w];
+	map = new Map_t(size, layout);
+	lightMap = new LightMap_t(size, layout);
+	distanceMap = new DistanceMap_t(size, layout);
+	winMap = new Map_t(winMapSize, layout);
+	winLightMap = new LightMap_t(winMapSize, layout);
+	winDistanceMap = new DistanceMap_t(winMapSize, layout);
 
 	curMap = map;
 	curLightMap = lightMap;
+	curDistanceMap = distanceMap;
 }
 
 Field::~Field()
 {
-	delete[] map;
-	delete[] lightMap;
-	delete[] winMap;
-	delete[] winLightMap;
+	delete map;
+	delete lightMap;
+	delete distanceMap;
+	delete winMap;
+	delete winLightMap;
+	delete winDistanceMap;
+
+	// The field may outlive the GL context (e.g. on exit)
+	if (mapTextureId != 0 && glfwGetCurrentContext() != nullptr)
+	{
+		glDeleteTextures(1, &mapTextureId);
+		glDeleteTextures(1, &lightMapTextureId);
+	}
 }
 
-void Field::Init(Maze* maze, Shader* shader)
+void Field::Init(Maze* maze, Shader* shader, WorldCache* worldCache)
 {
 	this->shader = shader;
 
-	for (int i = 0; i < totalSize; i++)
-	{
-		curMap[i] = 0;
-		curLightMap[i] = 0;
-	}
+	Generate(maze);
+
+	uint8_t* curMapTexture = new uint8_t[GetMapTextureBytes()];
+	uint8_t* curLightMapTexture = new uint8_t[GetLightTextureBytes()];
+	PackTextures(curMapTexture, curLightMapTexture);
+	if (worldCache != nullptr)
+		Save(worldCache, curMapTexture, curLightMapTexture);
+	UploadTextures(shader, curMapTexture, curLightMapTexture);
+	delete[] curMapTexture;
+	delete[] curLightMapTexture;
+
+	int64_t memBytes = map->GetMemoryBytes() + lightMap->GetMemoryBytes() + distanceMap->GetMemoryBytes() +
+		winMap->GetMemoryBytes() + winLightMap->GetMemoryBytes() + winDistanceMap->GetMemoryBytes();
+	Log("cubesCount: ", cubesCount, ", mem(map): ", memBytes / 1024.0f / 1024.0f, " Mb, dense: ",
+		(sizeof(Cell_t) + sizeof(Light_t)) * totalSize / 1024.0f / 1024.0f, " Mb");
+}
+
+void Field::Generate(Maze* maze)
+{
+	curMap->Fill(0);
+	curLightMap->Fill(0);
+	lights.clear();
+	cubesCount = 0;
 
 	CreateBorders();
 	CreateExit(maze);
-	GenerateWalls(maze);
-	GenerateLight(maze);
+	if (maze->IsGenerated())
+	{
+		GenerateWalls(maze, 0, maze->size.x);
+		GenerateLight(maze, 0, maze->size.x);
+	}
+	else
+	{
+		GenerateStreamed(maze);
+	}
+	GenerateMapEdgesLight();
 
-	this->LoadMazeToGL(shader);
+	curMap->Compact();
+	curLightMap->Compact();
+
+	ComputeDistances(glm::ivec4(0), size);
+	curDistanceMap->Compact();
+}
+
+// Bricks are saved as the uniform values of all bricks, payload flags and the payloads
+template <typename T>
+static void SaveBricks(WorldCache* worldCache, const BrickStore<T>* store)
+{
+	int64_t bricksCount = store->GetBricksCount();
+	std::vector<T> uniformValues(bricksCount);
+	std::vector<uint8_t> hasPayload(bricksCount);
+	for (int64_t b = 0; b < bricksCount; b++)
+	{
+		uniformValues[b] = store->GetUniformValue(b);
+		hasPayload[b] = store->GetPayload(b) != nullptr;
+	}
+	worldCache->Write(uniformValues.data(), bricksCount * sizeof(T));
+	worldCache->Write(hasPayload.data(), bricksCount);
 
-	int memBytes = (sizeof(Cell_t) + sizeof(Light_t)) * (totalSize + winMapSize.x*winMapSize.y*winMapSize.z*winMapSize.z);
-	Log("cubesCount: ", cubesCount, ", mem(map): ", memBytes / 1024.0f / 1024.0f, " Mb");
+	for (int64_t b = 0; b < bricksCount; b++)
+		if (hasPayload[b])
+			worldCache->Write(store->GetPayload(b), BRICK_CELLS * sizeof(T));
+}
+
+template <typename T>
+static bool LoadBricks(WorldCache* worldCache, BrickStore<T>* store)
+{
+	int64_t bricksCount = store->GetBricksCount();
+	const T* uniformValues = (const T*)worldCache->Read(bricksCount * sizeof(T));
+	const uint8_t* hasPayload = worldCache->Read(bricksCount);
+	if (uniformValues == nullptr || hasPayload == nullptr)
+		return false;
+
+	for (int64_t b = 0; b < bricksCount; b++)
+	{
+		const T* payload = nullptr;
+		if (hasPayload[b])
+		{
+			payload = (const T*)worldCache->Read(BRICK_CELLS * sizeof(T));
+			if (payload == nullptr)
+				return false;
+		}
+		store->SetBrick(b, payload, uniformValues[b]);
+	}
+	return true;
+}
+
+void Field::Save(WorldCache* worldCache, const uint8_t* curMapTexture, const uint8_t* curLightMapTexture)
+{
+	if (!worldCache->BeginWrite())
+		return;
+
+	std::string randomState = Random::GetInstance()->GetState();
+	worldCache->WriteValue(uint64_t(randomState.size()));
+	worldCache->Write(randomState.data(), randomState.size());
+
+	worldCache->WriteValue(cubesCount);
+	worldCache->WriteValue(uint64_t(lights.size()));
+	worldCache->Write(lights.data(), lights.size() * sizeof(glm::ivec4));
+
+	SaveBricks(worldCache, curMap);
+	SaveBricks(worldCache, curLightMap);
+	SaveBricks(worldCache, curDistanceMap);
+
+	worldCache->Write(curMapTexture, GetMapTextureBytes());
+	worldCache->Write(curLightMapTexture, GetLightTextureBytes());
+
+	if (worldCache->EndWrite())
+		Log("World is saved to ", worldCache->fileName);
+}
+
+bool Field::Load(WorldCache* worldCache, Shader* shader)
+{
+	this->shader = shader;
+
+	if (!worldCache->Open())
+		return false;
+
+	// Reads the blocks in the order of Save, the file is already validated by the checksum,
+	// so a wrong block size means the file doesn't match the field
+	auto load = [&]()
+	{
+		uint64_t randomStateBytes = 0;
+		if (!worldCache->ReadValue(randomStateBytes))
+			return false;
+		const char* randomState = (const char*)worldCache->Read(randomStateBytes);
+		if (randomState == nullptr)
+			return false;
+
+		uint64_t lightsCount = 0;
+		if (!worldCache->ReadValue(cubesCount) || !worldCache->ReadValue(lightsCount))
+			return false;
+		const glm::ivec4* savedLights = (const glm::ivec4*)worldCache->Read(lightsCount * sizeof(glm::ivec4));
+		if (savedLights == nullptr)
+			return false;
+
+		if (!LoadBricks(worldCache, curMap) || !LoadBricks(worldCache, curLightMap) || !LoadBricks(worldCache, curDistanceMap))
+			return false;
+
+		const uint8_t* curMapTexture = worldCache->Read(GetMapTextureBytes());
+		const uint8_t* curLightMapTexture = worldCache->Read(GetLightTextureBytes());
+		if (curMapTexture == nullptr || curLightMapTexture == nullptr)
+			return false;
+
+		lights.assign(savedLights, savedLights + lightsCount);
+		Random::GetInstance()->SetState(std::string(randomState, randomStateBytes));
+		UploadTextures(shader, curMapTexture, curLightMapTexture);
+		return true;
+	};
+
+	bool isLoaded = load();
+	worldCache->Close();
+	if (!isLoaded)
+	{
+		Log("World cache ", worldCache->fileName, " doesn't match the field");
+		return false;
+	}
+
+	Log("World is loaded from ", worldCache->fileName, ", cubesCount: ", cubesCount);
+	return true;
 }
 
 void Field::CreateCube(int x, int y, int z, int w)
 {
-	int index = GetIndex(x, y, z, w);
-	if ((curMap[index] & WALL_BLOCK) == 0)
+	int64_t index = GetIndex(x, y, z, w);
+	Cell_t cell = curMap->Get(index);
+	if ((cell & WALL_BLOCK) == 0)
 	{
-		curMap[index] |= WALL_BLOCK;
+		curMap->Set(index, cell | WALL_BLOCK);
 		cubesCount++;
 	}
 };
@@ -59,15 +218,14 @@ void Field::CreateBorders()
 		{
 			for (int z = 0; z < size.z; z++)
 			{
-				for (int w = 0; w < size.w; w++)
+				// Inside the map only the ends of the w-row are on the border
+				bool isBorderRow = !(x > 0 && x < (size.x - 1) &&
+					y > 0 && y < (size.y - 1) &&
+					z > 0 && z < (size.z - 1));
+				int wStep = isBorderRow ? 1 : glm::max(size.w - 1, 1);
+				for (int w = 0; w < size.w; w += wStep)
 				{
-					if (!(x > 0 && x < (size.x - 1) &&
-						y > 0 && y < (size.y - 1) &&
-						z > 0 && z < (size.z - 1) &&
-						w > 0 && w < (size.w - 1)))
-					{
-						CreateCube(x, y, z, w);
-					}
+					CreateCube(x, y, z, w);
 				}
 			}
 		}
@@ -108,8 +266,8 @@ void Field::CreateExit(Maze* maze)
 				{
 					for (int w = start.w; w < end.w; w++)
 					{
-						int index = GetIndex(x, y, z, w);
-						curMap[index] = WIN_BLOCK;
+						int64_t index = GetIndex(x, y, z, w);
+						curMap->Set(index, WIN_BLOCK);
 						cubesCount--;
 					}
 				}
@@ -126,150 +284,238 @@ void Field::CreateExit(Maze* maze)
 		createExit(edgesForExit[rnd->GetInt(0, edgesForExit.size() - 1)]);
 }
 
-void Field::GenerateWalls(Maze* maze)
+void Field::GenerateStreamed(Maze* maze)
 {
-	auto createShape = [&](glm::ivec4 start, glm::ivec4 end)
+	// Light passes up to lightDist - 1 cubes, so a light of the room layer x can reach walls
+	// of the layer x + lag at most. Lights are placed when all these walls exist,
+	// and the maze keeps the layers back to x - 1 for the walls of the room.
+	int lag = lightDist / roomSize + 1;
+	maze->BeginStream(lag + 2);
+
+	for (int i = 0; i < maze->size.x; i++)
 	{
-		end.x = glm::min(end.x, size.x - 1);
-		end.y = glm::min(end.y, size.y - 1);
-		end.z = glm::min(end.z, size.z - 1);
-		end.w = glm::min(end.w, size.w - 1);
+		int x = maze->NextSlab();
+		GenerateWalls(maze, x, x + 1);
+		if (x >= lag)
+			GenerateLight(maze, x - lag, x - lag + 1);
+	}
+	GenerateLight(maze, glm::max(maze->size.x - lag, 0), maze->size.x);
+}
 
-		for (int x = start.x; x < end.x; x++)
-		{
-			for (int y = start.y; y < end.y; y++)
-			{
-				for (int z = start.z; z < end.z; z++)
+// Cube position inside a room along one axis: on the negative plane of the room,
+// inside it or on the positive plane (the negative plane of the next room)
+#define ROOM_POS_NEG 0
+#define ROOM_POS_IN 1
+#define ROOM_POS_POS 2
+
+// Walls of a room for every wall configuration (bit e - wall on edge e) and x, y, z cube positions.
+// Bit n of the template is the wall for w cube position n.
+static uint8_t roomTemplates[256][3][3][3];
+
+static void InitRoomTemplates()
+{
+	static bool isInitialized = false;
+	if (isInitialized)
+		return;
+	isInitialized = true;
+
+	for (int config = 0; config < 256; config++)
+		for (int px = 0; px < 3; px++)
+			for (int py = 0; py < 3; py++)
+				for (int pz = 0; pz < 3; pz++)
 				{
-					for (int w = start.w; w < end.w; w++)
+					roomTemplates[config][px][py][pz] = 0;
+					for (int pw = 0; pw < 3; pw++)
 					{
-						CreateCube(x, y, z, w);
+						int pos[4] = { px, py, pz, pw };
+						bool isWall = false;
+
+						// Walls are created on negative edges only
+						for (int axis = 0; axis < 4; axis++)
+						{
+							bool isOnPlane = pos[axis] == ROOM_POS_NEG;
+							for (int other = 0; other < 4; other++)
+								if (other != axis && pos[other] == ROOM_POS_POS)
+									isOnPlane = false;
+							if (isOnPlane && (config >> (axis * 2)) & 1)
+								isWall = true;
+						}
+
+						// Corners on negative edges of adjoining rooms, where 2 or more positive walls meet
+						int cornerAxes = 0;
+						bool isCornerClosed = true;
+						for (int axis = 0; axis < 4; axis++)
+						{
+							if (pos[axis] == ROOM_POS_POS)
+							{
+								cornerAxes++;
+								if (((config >> (axis * 2 + 1)) & 1) == 0)
+									isCornerClosed = false;
+							}
+						}
+						if (cornerAxes >= 2 && isCornerClosed)
+							isWall = true;
+
+						if (isWall)
+							roomTemplates[config][px][py][pz] |= 1 << pw;
 					}
 				}
-			}
-		}
-	};
-
+}
 
-	for (int x = 0; x < maze->size.x; x++)
-	{
+void Field::GenerateWalls(Maze* maze, int fromX, int toX)
+{
+	InitRoomTemplates();
+
+	glm::ivec4 step = glm::ivec4(
+		size.x / maze->size.x,
+		size.y / maze->size.y,
+		size.z / maze->size.z,
+		size.w / maze->size.w);
+
+	// Wall configuration of every room in layers [fromX, toX)
+	int sliceSize = maze->size.y*maze->size.z*maze->size.w;
+	std::vector<uint8_t> configs((toX - fromX) * sliceSize);
+	for (int x = fromX; x < toX; x++)
 		for (int y = 0; y < maze->size.y; y++)
-		{
 			for (int z = 0; z < maze->size.z; z++)
-			{
 				for (int w = 0; w < maze->size.w; w++)
 				{
-					glm::ivec4 step = glm::ivec4(
-						size.x / maze->size.x,
-						size.y / maze->size.y,
-						size.z / maze->size.z,
-						size.w / maze->size.w);
-
-					// Create walls (only on negative edges)
-					if (maze->IsWallExist(NEG_X, glm::ivec4(x, y, z, w)))
-					{
-						createShape(glm::ivec4(x*step.x, y*step.y, z*step.z, w*step.w),
-							glm::ivec4(x*step.x + 1, (y + 1)*step.y, (z + 1)*step.z, (w + 1)*step.w));
-					}
-					if (maze->IsWallExist(NEG_Y, glm::ivec4(x, y, z, w)))
-					{
-						createShape(glm::ivec4(x*step.x, y*step.y, z*step.z, w*step.w),
-							glm::ivec4((x + 1)*step.x, y*step.y + 1, (z + 1)*step.z, (w + 1)*step.w));
-					}
-					if (maze->IsWallExist(NEG_Z, glm::ivec4(x, y, z, w)))
-					{
-						createShape(glm::ivec4(x*step.x, y*step.y, z*step.z, w*step.w),
-							glm::ivec4((x + 1)*step.x, (y + 1)*step.y, z*step.z + 1, (w + 1)*step.w));
-					}
-					if (maze->IsWallExist(NEG_W, glm::ivec4(x, y, z, w)))
-					{
-						createShape(glm::ivec4(x*step.x, y*step.y, z*step.z, w*step.w),
-							glm::ivec4((x + 1)*step.x, (y + 1)*step.y, (z + 1)*step.z, w*step.w + 1));
-					}
+					uint8_t config = 0;
+					for (int e = 0; e < EDGES_COUNT; e++)
+						if (maze->IsWallExist(e, glm::ivec4(x, y, z, w)))
+							config |= 1 << e;
+					configs[((x - fromX)*maze->size.y + y)*maze->size.z*maze->size.w + z*maze->size.w + w] = config;
+				}
 
-					// Create corners (check positive edges in current room and create corners
-					// on negative edges in adjoining rooms)
-					if (maze->IsWallExist(POS_X, glm::ivec4(x, y, z, w)) && maze->IsWallExist(POS_Y, glm::ivec4(x, y, z, w)))
-					{
-						createShape(glm::ivec4((x + 1)*step.x, (y + 1)*step.y, z*step.z, w*step.w),
-							glm::ivec4((x + 1)*step.x + 1, (y + 1)*step.y + 1, (z + 1)*step.z, (w + 1)*step.w));
-					}
-					if (maze->IsWallExist(POS_X, glm::ivec4(x, y, z, w)) && maze->IsWallExist(POS_Z, glm::ivec4(x, y, z, w)))
-					{
-						createShape(glm::ivec4((x + 1)*step.x, y*step.y, (z + 1)*step.z, w*step.w),
-							glm::ivec4((x + 1)*step.x + 1, (y + 1)*step.y, (z + 1)*step.z + 1, (w + 1)*step.w));
-					}
-					if (maze->IsWallExist(POS_X, glm::ivec4(x, y, z, w)) && maze->IsWallExist(POS_W, glm::ivec4(x, y, z, w)))
-					{
-						createShape(glm::ivec4((x + 1)*step.x, y*step.y, z*step.z, (w + 1)*step.w),
-							glm::ivec4((x + 1)*step.x + 1, (y + 1)*step.y, (z + 1)*step.z, (w + 1)*step.w + 1));
-					}
-					if (maze->IsWallExist(POS_Y, glm::ivec4(x, y, z, w)) && maze->IsWallExist(POS_Z, glm::ivec4(x, y, z, w)))
-					{
-						createShape(glm::ivec4(x*step.x, (y + 1)*step.y, (z + 1)*step.z, w*step.w),
-							glm::ivec4((x + 1)*step.x, (y + 1)*step.y + 1, (z + 1)*step.z + 1, (w + 1)*step.w));
-					}
-					if (maze->IsWallExist(POS_Y, glm::ivec4(x, y, z, w)) && maze->IsWallExist(POS_W, glm::ivec4(x, y, z, w)))
-					{
-						createShape(glm::ivec4(x*step.x, (y + 1)*step.y, z*step.z, (w + 1)*step.w),
-							glm::ivec4((x + 1)*step.x, (y + 1)*step.y + 1, (z + 1)*step.z, (w + 1)*step.w + 1));
-					}
-					if (maze->IsWallExist(POS_Z, glm::ivec4(x, y, z, w)) && maze->IsWallExist(POS_W, glm::ivec4(x, y, z, w)))
-					{
-						createShape(glm::ivec4(x*step.x, y*step.y, (z + 1)*step.z, (w + 1)*step.w),
-							glm::ivec4((x + 1)*step.x, (y + 1)*step.y, (z + 1)*step.z + 1, (w + 1)*step.w + 1));
-					}
-					if (maze->IsWallExist(POS_X, glm::ivec4(x, y, z, w)) && maze->IsWallExist(POS_Y, glm::ivec4(x, y, z, w)) &&
-						maze->IsWallExist(POS_Z, glm::ivec4(x, y, z, w)))
-					{
-						createShape(glm::ivec4((x + 1)*step.x, (y + 1)*step.y, (z + 1)*step.z, w*step.w),
-							glm::ivec4((x + 1)*step.x + 1, (y + 1)*step.y + 1, (z + 1)*step.z + 1, (w + 1)*step.w));
-					}
-					if (maze->IsWallExist(POS_X, glm::ivec4(x, y, z, w)) && maze->IsWallExist(POS_Y, glm::ivec4(x, y, z, w)) &&
-						maze->IsWallExist(POS_W, glm::ivec4(x, y, z, w)))
-					{
-						createShape(glm::ivec4((x + 1)*step.x, (y + 1)*step.y, z*step.z, (w + 1)*step.w),
-							glm::ivec4((x + 1)*step.x + 1, (y + 1)*step.y + 1, (z + 1)*step.z, (w + 1)*step.w + 1));
-					}
-					if (maze->IsWallExist(POS_X, glm::ivec4(x, y, z, w)) && maze->IsWallExist(POS_Z, glm::ivec4(x, y, z, w)) &&
-						maze->IsWallExist(POS_W, glm::ivec4(x, y, z, w)))
+	// Rooms (and cube positions in them) which contain cube c along one axis.
+	// Planes between rooms belong to both of them. The last cube of the map is the border.
+	struct RoomPos { int room; int pos; };
+	auto findRooms = [](int c, int step, int fromRoom, int toRoom, RoomPos* rooms)
+	{
+		int count = 0;
+		int room = c / step;
+		if (c % step != 0)
+		{
+			if (room >= fromRoom && room < toRoom)
+				rooms[count++] = { room, ROOM_POS_IN };
+			return count;
+		}
+		if (room >= fromRoom && room < toRoom)
+			rooms[count++] = { room, ROOM_POS_NEG };
+		if (room - 1 >= fromRoom && room - 1 < toRoom)
+			rooms[count++] = { room - 1, ROOM_POS_POS };
+		return count;
+	};
+
+	// Cubes of rooms [fromX, toX) are stamped by rows along w. Threads get brick-aligned
+	// x and y ranges, so they never write to the same brick.
+	int fromCubeX = fromX * step.x;
+	int toCubeX = glm::min(toX * step.x + 1, size.x - 1);
+	int firstBrickX = fromCubeX >> BRICK_BITS;
+	int bricksX = ((toCubeX - 1) >> BRICK_BITS) - firstBrickX + 1;
+	int bricksY = ((size.y - 2) >> BRICK_BITS) + 1;
+	int newCubes = 0;
+
+	#pragma omp parallel for reduction(+:newCubes)
+	for (int b = 0; b < bricksX * bricksY; b++)
+	{
+		int brickX = firstBrickX + b / bricksY;
+		int brickY = b % bricksY;
+		int endX = glm::min((brickX + 1) << BRICK_BITS, toCubeX);
+		int endY = glm::min((brickY + 1) << BRICK_BITS, size.y - 1);
+
+		std::vector<uint8_t> row(size.w);
+		RoomPos roomsX[2], roomsY[2], roomsZ[2];
+		int countX, countY, countZ;
+
+		// Collects the w-row from all rooms which contain it, returns false for the empty row
+		auto collectRow = [&]()
+		{
+			std::fill(row.begin(), row.end(), 0);
+			bool isRowEmpty = true;
+			for (int ix = 0; ix < countX; ix++)
+				for (int iy = 0; iy < countY; iy++)
+					for (int iz = 0; iz < countZ; iz++)
 					{
-						createShape(glm::ivec4((x + 1)*step.x, y*step.y, (z + 1)*step.z, (w + 1)*step.w),
-							glm::ivec4((x + 1)*step.x + 1, (y + 1)*step.y, (z + 1)*step.z + 1, (w + 1)*step.w + 1));
+						const uint8_t* roomConfigs = &configs[(((roomsX[ix].room - fromX)*maze->size.y + roomsY[iy].room)*maze->size.z +
+							roomsZ[iz].room) * maze->size.w];
+						for (int roomW = 0; roomW < maze->size.w; roomW++)
+						{
+							uint8_t walls = roomTemplates[roomConfigs[roomW]][roomsX[ix].pos][roomsY[iy].pos][roomsZ[iz].pos];
+							if (walls == 0)
+								continue;
+							isRowEmpty = false;
+
+							int start = roomW * step.w;
+							int end = glm::min(start + step.w, size.w - 1);
+							if ((walls & (1 << ROOM_POS_NEG)) != 0)
+								row[start] = 1;
+							if ((walls & (1 << ROOM_POS_IN)) != 0)
+								std::fill(row.begin() + start + 1, row.begin() + end, 1);
+							if ((walls & (1 << ROOM_POS_POS)) != 0 && start + step.w < size.w - 1)
+								row[start + step.w] = 1;
+						}
 					}
-					if (maze->IsWallExist(POS_Y, glm::ivec4(x, y, z, w)) && maze->IsWallExist(POS_Z, glm::ivec4(x, y, z, w)) &&
-						maze->IsWallExist(POS_W, glm::ivec4(x, y, z, w)))
+			return !isRowEmpty;
+		};
+
+		for (int x = glm::max(brickX << BRICK_BITS, fromCubeX); x < endX; x++)
+		{
+			countX = findRooms(x, step.x, fromX, toX, roomsX);
+			for (int y = brickY << BRICK_BITS; y < endY; y++)
+			{
+				countY = findRooms(y, step.y, 0, maze->size.y, roomsY);
+				bool isRowEmpty = true;
+				for (int z = 0; z < size.z - 1; z++)
+				{
+					// Cubes inside one room (except the first one) have the same w-row as the previous cube
+					if (z % step.z <= 1)
 					{
-						createShape(glm::ivec4(x*step.x, (y + 1)*step.y, (z + 1)*step.z, (w + 1)*step.w),
-							glm::ivec4((x + 1)*step.x, (y + 1)*step.y + 1, (z + 1)*step.z + 1, (w + 1)*step.w + 1));
+						countZ = findRooms(z, step.z, 0, maze->size.z, roomsZ);
+						isRowEmpty = !collectRow();
 					}
-					if (maze->IsWallExist(POS_X, glm::ivec4(x, y, z, w)) && maze->IsWallExist(POS_Y, glm::ivec4(x, y, z, w)) &&
-						maze->IsWallExist(POS_Z, glm::ivec4(x, y, z, w)) && maze->IsWallExist(POS_W, glm::ivec4(x, y, z, w)))
+					if (isRowEmpty)
+						continue;
+
+					// Write the row, the last cube is the border
+					int64_t rowIndex = GetIndex(x, y, z, 0);
+					for (int w = 0; w < size.w - 1; w++)
 					{
-						createShape(glm::ivec4((x + 1)*step.x, (y + 1)*step.y, (z + 1)*step.z, (w + 1)*step.w),
-							glm::ivec4((x + 1)*step.x + 1, (y + 1)*step.y + 1, (z + 1)*step.z + 1, (w + 1)*step.w + 1));
+						if (row[w] == 0)
+							continue;
+
+						Cell_t& cell = curMap->Ref(curMap->MoveIndex(rowIndex, 3, 0, w));
+						if ((cell & WALL_BLOCK) == 0)
+						{
+							cell |= WALL_BLOCK;
+							newCubes++;
+						}
 					}
 				}
 			}
 		}
 	}
+
+	cubesCount += newCubes;
 }
 
-void Field::GenerateLight(Maze* maze)
+void Field::GenerateLight(Maze* maze, int fromX, int toX)
 {
+	// Lights are spread after all of them are placed
+	size_t firstLight = lights.size();
 	auto generateLight = [&](glm::ivec4 pos)
 	{
-		int index = GetIndex(pos.x, pos.y, pos.z, pos.w);
-		GenerateLightRecursive(pos.x, pos.y, pos.z, pos.w, lightDist, -1);
-		curLightMap[index] = UINT32_MAX;
-		curMap[index] = LIGHT_BLOCK | WALL_BLOCK;
+		int64_t index = GetIndex(pos.x, pos.y, pos.z, pos.w);
+		curLightMap->Set(index, UINT32_MAX);
+		curMap->Set(index, LIGHT_BLOCK | WALL_BLOCK);
 		cubesCount++;
+		lights.push_back(pos);
 	};
 
 	Random* rnd = Random::GetInstance();
 
 	std::vector<int> tmpWalls;
-	for (int x = 0; x < maze->size.x; x++)
+	for (int x = fromX; x < toX; x++)
 	{
 		for (int y = 0; y < maze->size.y; y++)
 		{
@@ -333,57 +579,663 @@ void Field::GenerateLight(Maze* maze)
 			}
 		}
 	}
-	
+
+	PropagateLight(firstLight);
+}
+
+static unsigned int GetSideLight(const Light_t light, const int side)
+{
+	return (light >> (side * 4)) & (Texture::LIGHT_GRAD - 1);
+}
+
+static void SetSideLight(Light_t& light, const int side, const unsigned int level)
+{
+	// clear light
+	light &= ~((Texture::LIGHT_GRAD - 1) << (side * 4));
+	// set light
+	light |= level << (side * 4);
+}
+
+void Field::PropagateLight(const size_t firstLight)
+{
+	if (firstLight >= lights.size() || lightDist <= 0)
+		return;
+
+	// Light goes up to lightDist - 1 cubes from its source
+	int minX = size.x;
+	int maxX = 0;
+	for (size_t i = firstLight; i < lights.size(); i++)
+	{
+		minX = glm::min(minX, lights[i].x);
+		maxX = glm::max(maxX, lights[i].x);
+	}
+	int fromCubeX = glm::max(minX - lightDist + 1, 0);
+	int toCubeX = glm::min(maxX + lightDist, size.x);
+
+	std::vector<unsigned int> scaledLevels = GetScaledLightLevels();
+
+	std::unordered_map<int64_t, int> lightOrder;
+	for (size_t i = firstLight; i < lights.size(); i++)
+		lightOrder[GetIndex(lights[i].x, lights[i].y, lights[i].z, lights[i].w)] = int(i);
+
+	// Every thread lights its own brick-aligned range of x-layers
+	int firstBrick = fromCubeX >> BRICK_BITS;
+	int bricksCount = ((toCubeX - 1) >> BRICK_BITS) - firstBrick + 1;
+	int chunksCount = glm::min(glm::max((int)std::thread::hardware_concurrency(), 1), bricksCount);
+
+	#pragma omp parallel for
+	for (int c = 0; c < chunksCount; c++)
+	{
+		int chunkFrom = glm::max((firstBrick + bricksCount * c / chunksCount) << BRICK_BITS, fromCubeX);
+		int chunkTo = glm::min((firstBrick + bricksCount * (c + 1) / chunksCount) << BRICK_BITS, toCubeX);
+		PropagateLight(firstLight, chunkFrom, chunkTo, lightOrder, scaledLevels);
+	}
+}
+
+// Level-ordered flood fill from every light, one after another, updating walls in x-layers [fromX, toX).
+// Light level in an empty cube is the best level of all lights so far, a light stops where the previous
+// one was at least as bright. Paths to these layers can't go further than lightDist from them,
+// so only these cubes are loaded.
+void Field::PropagateLight(const size_t firstLight, const int fromX, const int toX,
+	const std::unordered_map<int64_t, int>& lightOrder, const std::vector<unsigned int>& scaledLevels)
+{
+	// Scratch of the cubes around the layers, sparse as the map: only the bricks, which the light
+	// goes through, get memory. Type of the cube is loaded from the map on the first access
+	// and kept in the high bits, the light level is in the low ones.
+	enum { CUBE_LOADED = 0x8000, CUBE_WALL = 0x4000, CUBE_LIGHT = 0x2000, CUBE_LEVEL = 0x1FFF };
+	assert(lightDist <= CUBE_LEVEL);
+
+	int boxFrom = glm::max(fromX - lightDist, 0);
+	int boxTo = glm::min(toX + lightDist, size.x);
+	BrickStore<uint16_t> cubes(glm::ivec4(boxTo - boxFrom, size.y, size.z, size.w));
+
+	auto getCube = [&](const int64_t index, const glm::ivec4& pos) -> uint16_t&
+	{
+		uint16_t& cube = cubes.Ref(index);
+		if (cube == 0)
+		{
+			Cell_t cell = curMap->Get(GetIndex(pos.x, pos.y, pos.z, pos.w));
+			cube = CUBE_LOADED;
+			if ((cell & LIGHT_BLOCK) != 0)
+				cube |= CUBE_LIGHT;
+			else if ((cell & WALL_BLOCK) != 0)
+				cube |= CUBE_WALL;
+		}
+		return cube;
+	};
+
+	struct QueueItem { int64_t index; glm::ivec4 pos; int level; };
+	std::vector<QueueItem> queue;
+
+	for (size_t i = firstLight; i < lights.size(); i++)
+	{
+		const glm::ivec4& light = lights[i];
+		if (light.x <= fromX - lightDist || light.x >= toX + lightDist - 1)
+			continue;
+
+		int64_t start = cubes.GetIndex(light.x - boxFrom, light.y, light.z, light.w);
+		uint16_t& startCube = getCube(start, light);
+		if ((startCube & CUBE_LEVEL) >= lightDist)
+			continue;
+		startCube = (startCube & ~CUBE_LEVEL) | lightDist;
+
+		queue.clear();
+		queue.push_back({ start, light, lightDist });
+		for (size_t head = 0; head < queue.size(); head++)
+		{
+			QueueItem item = queue[head];
+			int level = item.level - 1;
+			if (level == 0)
+				continue;
+
+			for (int e = 0; e < EDGES_COUNT; e++)
+			{
+				int axis = e / 2;
+				int dir = (e % 2 == 0) ? -1 : 1;
+				glm::ivec4 pos = item.pos;
+				pos[axis] += dir;
+				if (pos[axis] < 0 || pos[axis] >= size[axis] || pos.x < boxFrom || pos.x >= boxTo)
+					continue;
+
+				int boxOffset = axis == AXIS_X ? boxFrom : 0;
+				int64_t index = cubes.MoveIndex(item.index, axis, item.pos[axis] - boxOffset, pos[axis] - boxOffset);
+				uint16_t& cube = getCube(index, pos);
+
+				// Lights placed before this one are walls for it, the next ones are not there yet
+				if ((cube & CUBE_LIGHT) != 0)
+				{
+					std::unordered_map<int64_t, int>::const_iterator order = lightOrder.find(GetIndex(pos.x, pos.y, pos.z, pos.w));
+					if (order == lightOrder.end() || order->second < (int)i)
+						continue; // all sides of the light are fully lit already
+				}
+				else if ((cube & CUBE_WALL) != 0)
+				{
+					if (pos.x < fromX || pos.x >= toX)
+						continue;
+
+					// Side of the wall, which faces the light
+					int side = e ^ 1;
+					Light_t& wallLight = curLightMap->Ref(GetIndex(pos.x, pos.y, pos.z, pos.w));
+					if (GetSideLight(wallLight, side) < scaledLevels[level])
+						SetSideLight(wallLight, side, scaledLevels[level]);
+					continue;
+				}
+
+				if ((cube & CUBE_LEVEL) >= level)
+					continue;
+				cube = (cube & ~CUBE_LEVEL) | level;
+				queue.push_back({ index, pos, level });
+			}
+		}
+	}
+}
+
+void Field::GenerateMapEdgesLight()
+{
+	// Only walls on the map border have map edges
 	for (int x = 0; x < size.x; x++)
 	{
 		for (int y = 0; y < size.y; y++)
 		{
 			for (int z = 0; z < size.z; z++)
 			{
-				for (int w = 0; w < size.w; w++)
+				bool isBorderRow = !(x > 0 && x < (size.x - 1) &&
+					y > 0 && y < (size.y - 1) &&
+					z > 0 && z < (size.z - 1));
+				int wStep = isBorderRow ? 1 : glm::max(size.w - 1, 1);
+				for (int w = 0; w < size.w; w += wStep)
 				{
-					for (int e = 0; e < EDGES_COUNT; e++)
-					{
-						int level = 15;
-						unsigned int scaledLevel = 10;
-
-						int index = GetIndex(x, y, z, w);
-						if (index == 0)
-							int b = 0;
-						bool isMapEdge = false;
-						if (x == 0 && e == NEG_X) isMapEdge = true;
-						if (y == 0 && e == NEG_Y) isMapEdge = true;
-						if (z == 0 && e == NEG_Z) isMapEdge = true;
-						if (w == 0 && e == NEG_W) isMapEdge = true;
-						if (x == size.x - 1 && e == POS_X) isMapEdge = true;
-						if (y == size.y - 1 && e == POS_Y) isMapEdge = true;
-						if (z == size.z - 1 && e == POS_Z) isMapEdge = true;
-						if (w == size.w - 1 && e == POS_W) isMapEdge = true;
-
-						if (isMapEdge)
-						{
-							// clear light
-							curLightMap[index] &= ~((Texture::LIGHT_GRAD - 1) << (e * 4));
-							// set light
-							curLightMap[index]  |= scaledLevel << (e * 4);
-						}
+					int64_t index = GetIndex(x, y, z, w);
+					if ((curMap->Get(index) & WALL_BLOCK) == 0)
+						continue;
 
-					}
+					SetMapEdgesLight(glm::ivec4(x, y, z, w), curLightMap->Ref(index));
+				}
+			}
+		}
+	}
+}
+
+void Field::SetMapEdgesLight(const glm::ivec4 pos, Light_t& light)
+{
+	const unsigned int scaledLevel = 10;
+
+	for (int e = 0; e < EDGES_COUNT; e++)
+	{
+		bool isMapEdge = (e % 2 == 0) ? pos[e / 2] == 0 : pos[e / 2] == size[e / 2] - 1;
+		if (isMapEdge)
+			SetSideLight(light, e, scaledLevel);
+	}
+}
+
+std::vector<unsigned int> Field::GetScaledLightLevels()
+{
+	std::vector<unsigned int> scaledLevels(lightDist + 1);
+	for (int level = 0; level <= lightDist; level++)
+		scaledLevels[level] = int(level / float(lightDist) * (Texture::LIGHT_GRAD - 1));
+	return scaledLevels;
+}
+
+FieldBox Field::AddLight(const glm::ivec4 pos)
+{
+	int64_t index = GetIndex(pos.x, pos.y, pos.z, pos.w);
+	if (curMap->Get(index) != 0)
+		return FieldBox();
+
+	// The new light is the last one, so it doesn't block the others
+	curMap->Set(index, LIGHT_BLOCK | WALL_BLOCK);
+	curLightMap->Set(index, UINT32_MAX);
+	cubesCount++;
+	lights.push_back(pos);
+	FieldBox box = Relight(pos);
+	box.Add(UpdateDistances(pos));
+	return box;
+}
+
+FieldBox Field::RemoveLight(const glm::ivec4 pos)
+{
+	int64_t index = GetIndex(pos.x, pos.y, pos.z, pos.w);
+	if ((curMap->Get(index) & LIGHT_BLOCK) == 0)
+		return FieldBox();
+
+	lights.erase(std::find(lights.begin(), lights.end(), pos));
+	curMap->Set(index, 0);
+	curLightMap->Set(index, 0);
+	cubesCount--;
+	FieldBox box = Relight(pos);
+	box.Add(UpdateDistances(pos));
+	return box;
+}
+
+FieldBox Field::MoveLight(const glm::ivec4 from, const glm::ivec4 to)
+{
+	int64_t fromIndex = GetIndex(from.x, from.y, from.z, from.w);
+	int64_t toIndex = GetIndex(to.x, to.y, to.z, to.w);
+	if ((curMap->Get(fromIndex) & LIGHT_BLOCK) == 0 || curMap->Get(toIndex) != 0)
+		return FieldBox();
+
+	// The light keeps its order
+	*std::find(lights.begin(), lights.end(), from) = to;
+	curMap->Set(fromIndex, 0);
+	curLightMap->Set(fromIndex, 0);
+	curMap->Set(toIndex, LIGHT_BLOCK | WALL_BLOCK);
+	curLightMap->Set(toIndex, UINT32_MAX);
+
+	FieldBox box = Relight(from);
+	box.Add(Relight(to));
+	box.Add(UpdateDistances(from));
+	box.Add(UpdateDistances(to));
+	return box;
+}
+
+FieldBox Field::SetWall(const glm::ivec4 pos, const bool isWall)
+{
+	int64_t index = GetIndex(pos.x, pos.y, pos.z, pos.w);
+	Cell_t cell = curMap->Get(index);
+	if ((cell & (LIGHT_BLOCK | WIN_BLOCK)) != 0 || ((cell & WALL_BLOCK) != 0) == isWall)
+		return FieldBox();
+
+	curMap->Set(index, isWall ? WALL_BLOCK : 0);
+	curLightMap->Set(index, 0);
+	cubesCount += isWall ? 1 : -1;
+	FieldBox box = Relight(pos);
+	box.Add(UpdateDistances(pos));
+	return box;
+}
+
+// Only light paths through the changed center cube have changed. They reach walls within
+// lightDist - 1 cubes from it (found by the removal walk), and light of a wall side can come
+// through the center only if the side is not brighter than the center light would make it.
+// These sides are cleared and lit again by the lights which can reach them. Paths, which are opened
+// by the center, only add light to the walls, so the lights around the center are spread again too.
+FieldBox Field::Relight(const glm::ivec4 center)
+{
+	FieldBox box;
+	box.Add(center);
+	if (lightDist <= 0)
+		return box;
+
+	int reach = lightDist - 1;
+	auto getDistance = [&](const glm::ivec4 pos)
+	{
+		glm::ivec4 d = glm::abs(pos - center);
+		return d.x + d.y + d.z + d.w;
+	};
+
+	// Scratch for the cubes, which the paths can go through: cube types loaded from the map
+	// on the first access and marks, steps to the cleared sides and light levels
+	enum { CUBE_LOADED = 1, CUBE_WALL = 2, CUBE_LIGHT = 4, CUBE_VISITED = 8, CUBE_DIRTY_WALL = 16 };
+	glm::ivec4 scratchFrom = glm::max(center - 2 * reach, glm::ivec4(0));
+	glm::ivec4 scratchTo = glm::min(center + 2 * reach + 1, size);
+	BrickStore<uint8_t> cubes(scratchTo - scratchFrom);
+	BrickStore<uint16_t> steps(scratchTo - scratchFrom);
+
+	struct QueueItem { int64_t scratchIndex; glm::ivec4 pos; int level; };
+	std::vector<QueueItem> queue;
+
+	auto getItem = [&](const glm::ivec4 pos, const int level)
+	{
+		glm::ivec4 scratchPos = pos - scratchFrom;
+		QueueItem item = { cubes.GetIndex(scratchPos.x, scratchPos.y, scratchPos.z, scratchPos.w), pos, level };
+		return item;
+	};
+
+	auto getCube = [&](const QueueItem& item)
+	{
+		uint8_t& cube = cubes.Ref(item.scratchIndex);
+		if (cube == 0)
+		{
+			Cell_t cell = curMap->Get(GetIndex(item.pos.x, item.pos.y, item.pos.z, item.pos.w));
+			cube = CUBE_LOADED;
+			if ((cell & LIGHT_BLOCK) != 0)
+				cube |= CUBE_LIGHT;
+			else if ((cell & WALL_BLOCK) != 0)
+				cube |= CUBE_WALL;
+		}
+		return cube;
+	};
+
+	// Walks over the neighbours of the queue item inside the scratch, the item is copied
+	// as the queue may grow
+	auto forEachNeighbour = [&](const QueueItem item, auto visit)
+	{
+		for (int e = 0; e < EDGES_COUNT; e++)
+		{
+			glm::ivec4 pos = item.pos;
+			pos[e / 2] += (e % 2 == 0) ? -1 : 1;
+			if (pos[e / 2] >= scratchFrom[e / 2] && pos[e / 2] < scratchTo[e / 2])
+				visit(getItem(pos, item.level - 1), e);
+		}
+	};
+
+	std::vector<unsigned int> scaledLevels = GetScaledLightLevels();
+
+	// Removal. Level of the walk is the brightest light, which can come through the center.
+	// Cubes in front of the cleared sides are the targets for the new light.
+	struct DirtyWall { int64_t index; glm::ivec4 pos; Light_t oldLight; };
+	std::vector<DirtyWall> dirtyWalls;
+	std::vector<QueueItem> targets;
+
+	auto addDirtyWall = [&](const QueueItem& item)
+	{
+		cubes.Ref(item.scratchIndex) |= CUBE_DIRTY_WALL;
+		int64_t index = GetIndex(item.pos.x, item.pos.y, item.pos.z, item.pos.w);
+		dirtyWalls.push_back({ index, item.pos, curLightMap->Get(index) });
+	};
+
+	queue.push_back(getItem(center, reach));
+	bool isCenterWall = (getCube(queue[0]) & CUBE_WALL) != 0;
+	if (isCenterWall)
+		addDirtyWall(queue[0]);
+	cubes.Ref(queue[0].scratchIndex) |= CUBE_VISITED;
+	for (size_t head = 0; head < queue.size(); head++)
+	{
+		if (queue[head].level == 0)
+			continue;
+
+		const QueueItem item = queue[head];
+		forEachNeighbour(item, [&](const QueueItem& next, int e)
+		{
+			uint8_t cube = getCube(next);
+			if ((cube & CUBE_WALL) != 0)
+			{
+				if ((cube & CUBE_DIRTY_WALL) == 0)
+					addDirtyWall(next);
+
+				int side = e ^ 1;
+				Light_t& wallLight = curLightMap->Ref(GetIndex(next.pos.x, next.pos.y, next.pos.z, next.pos.w));
+				if (GetSideLight(wallLight, side) <= scaledLevels[item.level])
+				{
+					SetSideLight(wallLight, side, 0);
+					if (item.pos != center || !isCenterWall)
+						targets.push_back(item);
+				}
+			}
+			else if ((cube & CUBE_VISITED) == 0)
+			{
+				cubes.Ref(next.scratchIndex) |= CUBE_VISITED;
+				queue.push_back(next);
+			}
+		});
+	}
+
+	// All sides of the new wall are lit again
+	if (isCenterWall)
+	{
+		curLightMap->Set(dirtyWalls[0].index, 0);
+		forEachNeighbour(getItem(center, 0), [&](const QueueItem& next, int /*edge*/)
+		{
+			if ((getCube(next) & CUBE_WALL) == 0)
+				targets.push_back(next);
+		});
+	}
+
+	// Steps from the cubes to the nearest target (plus one). Light reaches the cleared side, if it comes
+	// to the target with level 2 at least, so paths longer than lightDist - 2 steps are not needed.
+	int maxSteps = glm::max(lightDist - 2, 0);
+	int targetsDist = 0;
+	queue.clear();
+	for (size_t i = 0; i < targets.size(); i++)
+	{
+		if (steps.Get(targets[i].scratchIndex) == 0)
+		{
+			steps.Set(targets[i].scratchIndex, 1);
+			queue.push_back(getItem(targets[i].pos, maxSteps));
+			targetsDist = glm::max(targetsDist, getDistance(targets[i].pos));
+		}
+	}
+	for (size_t head = 0; head < queue.size(); head++)
+	{
+		if (queue[head].level == 0)
+			continue;
+
+		const QueueItem item = queue[head];
+		forEachNeighbour(item, [&](const QueueItem& next, int /*edge*/)
+		{
+			if ((getCube(next) & CUBE_WALL) != 0 || steps.Get(next.scratchIndex) != 0)
+				return;
+			steps.Set(next.scratchIndex, maxSteps - next.level + 1);
+			queue.push_back(next);
+		});
+	}
+
+	// Spreads the light i from the start cube over the cubes, which canExpand allows, lighting the sides
+	// of the dirty walls. Earlier lights are walls for this one, as in PropagateLight.
+	std::unordered_map<int64_t, int> lightOrder;
+	for (size_t i = 0; i < lights.size(); i++)
+		if (getDistance(lights[i]) <= 2 * reach)
+			lightOrder[GetIndex(lights[i].x, lights[i].y, lights[i].z, lights[i].w)] = int(i);
+
+	auto spreadLight = [&](const int i, const QueueItem start, BrickStore<uint16_t>& levels, auto canExpand)
+	{
+		if (levels.Get(start.scratchIndex) >= start.level)
+			return;
+		levels.Set(start.scratchIndex, start.level);
+
+		queue.clear();
+		queue.push_back(start);
+		for (size_t head = 0; head < queue.size(); head++)
+		{
+			int level = queue[head].level - 1;
+			if (level == 0 || !canExpand(queue[head], level))
+				continue;
+
+			forEachNeighbour(queue[head], [&](const QueueItem& next, int e)
+			{
+				uint8_t cube = getCube(next);
+				if ((cube & CUBE_LIGHT) != 0)
+				{
+					std::unordered_map<int64_t, int>::const_iterator order =
+						lightOrder.find(GetIndex(next.pos.x, next.pos.y, next.pos.z, next.pos.w));
+					if (order == lightOrder.end() || order->second < i)
+						return;
+				}
+				else if ((cube & CUBE_WALL) != 0)
+				{
+					if ((cube & CUBE_DIRTY_WALL) == 0)
+						return;
+
+					int side = e ^ 1;
+					Light_t& wallLight = curLightMap->Ref(GetIndex(next.pos.x, next.pos.y, next.pos.z, next.pos.w));
+					if (GetSideLight(wallLight, side) < scaledLevels[level])
+						SetSideLight(wallLight, side, scaledLevels[level]);
+					return;
+				}
+
+				if (levels.Get(next.scratchIndex) >= level)
+					return;
+				levels.Set(next.scratchIndex, level);
+				queue.push_back(next);
+			});
+		}
+	};
+
+	// Cleared sides are lit by the lights within lightDist - 1 of them, a side is lit
+	// from the target in front of it, so the path should reach the target with level 2 at least
+	{
+		BrickStore<uint16_t> levels(scratchTo - scratchFrom);
+		for (size_t i = 0; i < lights.size(); i++)
+		{
+			if (getDistance(lights[i]) > targetsDist + reach || steps.Get(getItem(lights[i], 0).scratchIndex) == 0)
+				continue;
+			spreadLight(int(i), getItem(lights[i], lightDist), levels, [&](const QueueItem& item, const int level)
+			{
+				int itemSteps = steps.Get(item.scratchIndex);
+				return itemSteps != 0 && itemSteps <= level;
+			});
+		}
+	}
+
+	// Paths through the center, unless it is a wall now. Lights are spread to the center first,
+	// then further from it with the level they have there.
+	if (!isCenterWall)
+	{
+		BrickStore<uint16_t> levels(scratchTo - scratchFrom);
+		QueueItem centerItem = getItem(center, 0);
+		struct CenterLight { int light; int level; };
+		std::vector<CenterLight> centerLights;
+		for (size_t i = 0; i < lights.size(); i++)
+		{
+			if (getDistance(lights[i]) > reach)
+				continue;
+
+			int centerLevel = levels.Get(centerItem.scratchIndex);
+			spreadLight(int(i), getItem(lights[i], lightDist), levels, [&](const QueueItem& item, const int level)
+			{
+				return getDistance(item.pos) <= level && item.pos != center;
+			});
+
+			// Otherwise the earlier light was brighter at the center, and it has less walls on its way
+			if (levels.Get(centerItem.scratchIndex) > centerLevel)
+				centerLights.push_back({ int(i), levels.Get(centerItem.scratchIndex) });
+		}
+
+		levels.Fill(0);
+		for (size_t l = 0; l < centerLights.size(); l++)
+		{
+			spreadLight(centerLights[l].light, getItem(center, centerLights[l].level), levels,
+				[](const QueueItem&, const int) { return true; });
+		}
+	}
+
+	for (size_t i = 0; i < dirtyWalls.size(); i++)
+	{
+		Light_t light = curLightMap->Get(dirtyWalls[i].index);
+		SetMapEdgesLight(dirtyWalls[i].pos, light);
+		curLightMap->Set(dirtyWalls[i].index, light);
+		if (light != dirtyWalls[i].oldLight)
+			box.Add(dirtyWalls[i].pos);
+	}
+
+	return box;
+}
+
+// Chebyshev distance transform is separable: a pass along each axis takes the min of max(offset, distance)
+// over the row. Non-empty cubes are at distance 0, the cubes beyond the map count as non-empty,
+// so the leaps never leave the map. The cubes up to distanceMax around [from, to) are enough.
+FieldBox Field::ComputeDistances(const glm::ivec4 from, const glm::ivec4 to)
+{
+	// At the map edges the region includes one layer of the cubes outside of the map
+	glm::ivec4 regionFrom = glm::max(from - distanceMax, glm::ivec4(-1));
+	glm::ivec4 regionTo = glm::min(to + distanceMax, size + 1);
+
+	// Every thread computes and writes its own slab of whole bricks along x, so the scratch is only
+	// the slab with the cubes around it, not the whole region. Slabs are about as wide as these cubes.
+	int slabBricks = glm::max((2 * distanceMax) >> BRICK_BITS, 1);
+	int firstBrickX = from.x >> BRICK_BITS;
+	int bricksX = ((to.x - 1) >> BRICK_BITS) - firstBrickX + 1;
+	int slabsCount = (bricksX + slabBricks - 1) / slabBricks;
+	FieldBox box;
+
+	#pragma omp parallel for
+	for (int s = 0; s < slabsCount; s++)
+	{
+		int fromX = glm::max((firstBrickX + s * slabBricks) << BRICK_BITS, from.x);
+		int toX = glm::min((firstBrickX + (s + 1) * slabBricks) << BRICK_BITS, to.x);
+		FieldBox slabBox = ComputeSlabDistances(glm::ivec4(fromX, from.y, from.z, from.w),
+			glm::ivec4(toX, to.y, to.z, to.w), regionFrom, regionTo);
+
+		#pragma omp critical
+		box.Add(slabBox);
+	}
+
+	return box;
+}
+
+FieldBox Field::ComputeSlabDistances(const glm::ivec4 from, const glm::ivec4 to,
+	const glm::ivec4 regionFrom, const glm::ivec4 regionTo)
+{
+	// Distances are clamped by distanceMax, so only the cubes closer than that along x are needed
+	glm::ivec4 slabFrom(glm::max(from.x - distanceMax, regionFrom.x), regionFrom.y, regionFrom.z, regionFrom.w);
+	glm::ivec4 slabSize = glm::ivec4(glm::min(to.x + distanceMax, regionTo.x), regionTo.y, regionTo.z, regionTo.w) - slabFrom;
+	int64_t strides[4] = { int64_t(slabSize.y) * slabSize.z * slabSize.w, int64_t(slabSize.z) * slabSize.w, slabSize.w, 1 };
+	std::vector<uint8_t> distances(slabSize.x * strides[AXIS_X]);
+
+	int64_t slabIndex = 0;
+	for (int x = 0; x < slabSize.x; x++)
+		for (int y = 0; y < slabSize.y; y++)
+			for (int z = 0; z < slabSize.z; z++)
+				for (int w = 0; w < slabSize.w; w++, slabIndex++)
+				{
+					glm::ivec4 pos = slabFrom + glm::ivec4(x, y, z, w);
+					int distance = 0;
+					if (IsCubeIndexValid(pos.x, pos.y, pos.z, pos.w) && curMap->Get(GetIndex(pos.x, pos.y, pos.z, pos.w)) == 0)
+						distance = distanceMax;
+					distances[slabIndex] = distance;
+				}
+
+	// Chebyshev distance is separable: one pass along each axis. The cubes around the slab along x
+	// are only read by the x pass, the other passes go over the layers of the slab.
+	int slabFromX = from.x - slabFrom.x;
+	int slabToX = to.x - slabFrom.x;
+	std::vector<uint8_t> row;
+	for (int axis = 0; axis < 4; axis++)
+	{
+		int length = slabSize[axis];
+		int64_t layerRows = strides[AXIS_X] / (axis == AXIS_X ? 1 : length);
+		int64_t fromRow = axis == AXIS_X ? 0 : slabFromX * layerRows;
+		int64_t toRow = axis == AXIS_X ? layerRows : slabToX * layerRows;
+		int fromI = axis == AXIS_X ? slabFromX : 0;
+		int toI = axis == AXIS_X ? slabToX : length;
+		row.resize(length);
+
+		for (int64_t r = fromRow; r < toRow; r++)
+		{
+			// First cube of the row: the row index with the axis coordinate removed
+			int64_t first = (r / strides[axis]) * strides[axis] * length + r % strides[axis];
+			for (int i = 0; i < length; i++)
+				row[i] = distances[first + i * strides[axis]];
+
+			for (int i = fromI; i < toI; i++)
+			{
+				int distance = row[i];
+				for (int offset = 1; offset < distance; offset++)
+				{
+					if (i - offset >= 0)
+						distance = glm::min(distance, glm::max(offset, int(row[i - offset])));
+					if (i + offset < length)
+						distance = glm::min(distance, glm::max(offset, int(row[i + offset])));
 				}
+				distances[first + i * strides[axis]] = distance;
 			}
 		}
 	}
-	int i = 1;
+
+	FieldBox box;
+	for (int x = from.x; x < to.x; x++)
+		for (int y = from.y; y < to.y; y++)
+			for (int z = from.z; z < to.z; z++)
+				for (int w = from.w; w < to.w; w++)
+				{
+					glm::ivec4 slabPos = glm::ivec4(x, y, z, w) - slabFrom;
+					int64_t index = GetIndex(x, y, z, w);
+					uint8_t distance = distances[slabPos.x * strides[AXIS_X] + slabPos.y * strides[AXIS_Y] + slabPos.z * strides[AXIS_Z] + slabPos.w];
+					if (curDistanceMap->Get(index) != distance)
+					{
+						curDistanceMap->Set(index, distance);
+						box.Add(glm::ivec4(x, y, z, w));
+					}
+				}
+
+	return box;
+}
+
+FieldBox Field::UpdateDistances(const glm::ivec4 center)
+{
+	// Only the cubes closer than distanceMax can have the center as the nearest non-empty cube
+	return ComputeDistances(glm::max(center - (distanceMax - 1), glm::ivec4(0)),
+		glm::min(center + distanceMax, size));
 }
 
 void Field::CreateWinRoom()
 {
 	curMap = winMap;
 	curLightMap = winLightMap;
+	curDistanceMap = winDistanceMap;
 	size = winMapSize;
 
-	int mapSize = winMapSize.x*winMapSize.y*winMapSize.z*winMapSize.w;
-	memset(curMap, 0, mapSize);
+	curMap->Fill(0);
+	curLightMap->Fill(0);
 
 	// Generate walls
 	for (int x = 0; x < winMapSize.x; x++)
@@ -394,19 +1246,14 @@ void Field::CreateWinRoom()
 			{
 				for (int w = 0; w < winMapSize.w; w++)
 				{
-					int index = GetIndex(x, y, z, w);
+					int64_t index = GetIndex(x, y, z, w);
 					if (!(x > 0 && x < 8 &&
 						y > 0 && y < 8 &&
 						z > 0 && z < 8 &&
 						w > 0 && w < 8))
 					{
-						winMap[index] = WALL_BLOCK;
-					}
-					else
-					{
-						winMap[index] = 0;
+						winMap->Set(index, WALL_BLOCK);
 					}
-					winLightMap[index] = 0;
 				}
 			}
 		}
@@ -431,54 +1278,20 @@ void Field::CreateWinRoom()
 	{
 		for (int i = 0; i < sizeof(letters) / sizeof(letters[0]); i++)
 		{
-			winMap[GetIndex(letters[i].x, letters[i].y, letters[i].z, w)] = WALL_BLOCK;
-			winLightMap[GetIndex(letters[i].x, letters[i].y, letters[i].z, w)] = UINT32_MAX;
-		}
-	}
-
-	this->LoadMazeToGL(shader);
-}
-
-void Field::GenerateLightRecursive(int px, int py, int pz, int pw, unsigned int level, int side)
-{
-	if (level == 0 || !IsCubeIndexValid(px, py, pz, pw))
-		return;
-
-	unsigned int scaledLevel = int(level / float(lightDist) * (Texture::LIGHT_GRAD - 1));
-
-	int index = GetIndex(px, py, pz, pw);
-
-	if ((curMap[index] & WALL_BLOCK) != 0)
-	{
-		if (((curLightMap[index] >> (side * 4)) & (Texture::LIGHT_GRAD - 1)) < scaledLevel)
-		{
-			// clear light
-			curLightMap[index] &= ~((Texture::LIGHT_GRAD - 1) << (side * 4));
-			// set light
-			curLightMap[index] |= scaledLevel << (side * 4);
-			//curLightMap[index] = UINT32_MAX;
+			winMap->Set(GetIndex(letters[i].x, letters[i].y, letters[i].z, w), WALL_BLOCK);
+			winLightMap->Set(GetIndex(letters[i].x, letters[i].y, letters[i].z, w), UINT32_MAX);
 		}
-		return;
 	}
 
-	if (curLightMap[index] >= level)
-		return;
-	curLightMap[index] = level;
+	ComputeDistances(glm::ivec4(0), size);
 
-	if (side != POS_X) GenerateLightRecursive(px + 1, py, pz, pw, level - 1, NEG_X);
-	if (side != NEG_X) GenerateLightRecursive(px - 1, py, pz, pw, level - 1, POS_X);
-	if (side != POS_Y) GenerateLightRecursive(px, py + 1, pz, pw, level - 1, NEG_Y);
-	if (side != NEG_Y) GenerateLightRecursive(px, py - 1, pz, pw, level - 1, POS_Y);
-	if (side != POS_Z) GenerateLightRecursive(px, py, pz + 1, pw, level - 1, NEG_Z);
-	if (side != NEG_Z) GenerateLightRecursive(px, py, pz - 1, pw, level - 1, POS_Z);
-	if (side != POS_W) GenerateLightRecursive(px, py, pz, pw + 1, level - 1, NEG_W);
-	if (side != NEG_W) GenerateLightRecursive(px, py, pz, pw - 1, level - 1, POS_W);
+	this->LoadMazeToGL(shader);
 }
 
-int Field::GetIndex(const int x, const int y, const int z, const int w)
+int64_t Field::GetIndex(const int x, const int y, const int z, const int w)
 {
 	assert(IsCubeIndexValid(x, y, z, w));
-	return x*size.y*size.z*size.w + y*size.z*size.w + z*size.w + w;
+	return curMap->GetIndex(x, y, z, w);
 };
 
 bool Field::IsCubeIndexValid(int x, int y, int z, int w)
@@ -492,147 +1305,213 @@ bool Field::IsCubeIndexValid(int x, int y, int z, int w)
 
 Cell_t Field::GetCube(int x, int y, int z, int w)
 {
-	return curMap[GetIndex(x, y, z, w)];
+	return curMap->Get(GetIndex(x, y, z, w));
 };
 
 void Field::LoadMazeToGL(Shader* shader)
 {
-	glUseProgram(shader->ID);
-
-	GLint mapSizeLoc = glGetUniformLocation(shader->ID, "mapSize");
-	glUniform4i(mapSizeLoc, size.x, size.y, size.z, size.w); // Texture unit 4 is for current map. 
-
-	int texWxMax = ceil(std::pow(size.w, 1 / 3.0f)); //cube root
-	int texWyMax = texWxMax;
-	int texWzMax = texWyMax;	
-	GLint MapWnAddedSizeLoc = glGetUniformLocation(shader->ID, "MapWnAddedSize");
-	glUniform3i(MapWnAddedSizeLoc, texWxMax, texWyMax, texWzMax); 
-	 
-
-	int texSizeX = size.x * texWxMax;
-	int texSizeY = size.y * texWyMax;
-	int texSizeZ = size.z * texWzMax;
-	GLint MapTexSizeLoc = glGetUniformLocation(shader->ID, "MapTexSize");
-	glUniform3i(MapTexSizeLoc, texSizeX, texSizeY, texSizeZ); 
-
-	//Convert 4-axis coordinates to 3-axis coordinates
-	//Encode w coordinate equally across all xyz coords
-	//returns INT value which encodes xyz point for 4d point
-	auto GetTexIndex = [&](int x, int y, int z, int w)
-	{
-		//Assume w coordinate is index of 3 other coordinates
-		//What are they if we have length for each of them?
-		int texWz = w / (texWxMax*texWyMax);
-		int texWy = (w % (texWxMax*texWyMax)) / texWxMax;
-		int texWx = (w % (texWxMax*texWyMax)) % texWxMax;
-
-		assert(w == texWz * texWxMax*texWyMax + texWy*texWxMax + texWx);
-
-		int texX = texWx * size.x + x;
-		int texY = texWy * size.y + y;
-		int texZ = texWz * size.z + z;
-		
-		return 4 * (texZ * texSizeY * texSizeX + texY * texSizeX + texX);
+	uint8_t* curMapTexture = new uint8_t[GetMapTextureBytes()];
+	uint8_t* curLightMapTexture = new uint8_t[GetLightTextureBytes()];
+
+	PackTextures(curMapTexture, curLightMapTexture);
+	UploadTextures(shader, curMapTexture, curLightMapTexture);
+
+	delete[] curMapTexture;
+	delete[] curLightMapTexture;
+}
+
+glm::ivec3 Field::GetTextureSize()
+{
+	int layerGroups = (size.w + MAP_TEXTURE_LAYERS - 1) >> MAP_TEXTURE_LAYERS_BITS;
+	int zSlices = GetTextureZSlices();
+	int zGroups = (size.z + zSlices - 1) / zSlices;
+	return glm::ivec3(size.x * zGroups * layerGroups, size.y * zSlices, glm::min(size.w, MAP_TEXTURE_LAYERS));
+}
+
+int Field::GetTextureZSlices()
+{
+	// A slice higher than MAP_TEXTURE_HEIGHT still may fit into the GL limit
+	return glm::clamp(MAP_TEXTURE_HEIGHT / size.y, 1, size.z);
+}
+
+glm::ivec3 Field::GetTexel(const int x, const int y, const int z, const int w)
+{
+	int zSlices = GetTextureZSlices();
+	int zGroups = (size.z + zSlices - 1) / zSlices;
+	int group = (w >> MAP_TEXTURE_LAYERS_BITS) * zGroups + z / zSlices;
+	return glm::ivec3(group * size.x + x, (z % zSlices) * size.y + y, w & (MAP_TEXTURE_LAYERS - 1));
+}
+
+uint64_t Field::GetMapTextureBytes()
+{
+	glm::ivec3 texSize = GetTextureSize();
+	return uint64_t(texSize.z) * texSize.y * texSize.x;
+}
+
+uint64_t Field::GetLightTextureBytes()
+{
+	return 4 * GetMapTextureBytes();
+}
+
+// Map texel is the cube type or the distance for the empty cube (see MAP_TEXEL_REGULAR),
+// light texel is the light levels of the sides, 4 bits each
+void Field::PackCube(const int64_t index, uint8_t& mapTexel, uint8_t* lightTexel)
+{
+	Cell_t cell = curMap->Get(index);
+	mapTexel = curDistanceMap->Get(index); //no block by default
+
+	if ((cell & WALL_BLOCK) != 0)
+		mapTexel = MAP_TEXEL_REGULAR;
+	if ((cell & LIGHT_BLOCK) != 0)
+		mapTexel = MAP_TEXEL_LIGHT;
+
+	Light_t light = curLightMap->Get(index);
+	int LightLevelNegX = ((light >> (NEG_X * 4)) & (Texture::LIGHT_GRAD - 1));
+	int LightLevelPosX = ((light >> (POS_X * 4)) & (Texture::LIGHT_GRAD - 1));
+	int LightLevelNegY = ((light >> (NEG_Y * 4)) & (Texture::LIGHT_GRAD - 1));
+	int LightLevelPosY = ((light >> (POS_Y * 4)) & (Texture::LIGHT_GRAD - 1));
+	int LightLevelNegZ = ((light >> (NEG_Z * 4)) & (Texture::LIGHT_GRAD - 1));
+	int LightLevelPosZ = ((light >> (POS_Z * 4)) & (Texture::LIGHT_GRAD - 1));
+	int LightLevelNegW = ((light >> (NEG_W * 4)) & (Texture::LIGHT_GRAD - 1));
+	int LightLevelPosW = ((light >> (POS_W * 4)) & (Texture::LIGHT_GRAD - 1));
+
+	lightTexel[0] = LightLevelPosX * 16 + LightLevelNegX;
+	lightTexel[1] = LightLevelPosY * 16 + LightLevelNegY;
+	lightTexel[2] = LightLevelPosZ * 16 + LightLevelNegZ;
+	lightTexel[3] = LightLevelPosW * 16 + LightLevelNegW;
+}
+
+void Field::PackTextures(uint8_t* curMapTexture, uint8_t* curLightMapTexture)
+{
+	glm::ivec3 texSize = GetTextureSize();
+	int texSizeX = texSize.x;
+	int texSizeY = texSize.y;
+
+	//Convert 4-axis coordinates to the texel of the 2D array
+	auto GetTexIndex = [&](int x, int y, int z, int w) -> int64_t
+	{
+		glm::ivec3 texel = GetTexel(x, y, z, w);
+		return (int64_t(texel.z) * texSizeY + texel.y) * texSizeX + texel.x;
 	};
 
-	//each index is vec4 float structure 
-	//vec4.x - alpha channel for whole cube
-	//vec4.y - texture type (1 for regular, 2 for light)
-	//vec4.z - light level
-	uint64_t totalSizeForTexture = texSizeZ * texSizeY * texSizeX + texSizeY * texSizeX + texSizeX; //GetTexIndex(size.x, size.y, size.z, size.w);
-	uint8_t* curMapTexture = new uint8_t[4*totalSizeForTexture];
-	uint8_t* curLightMapTexture = new uint8_t[4*totalSizeForTexture];
-	//floatBitsToInt
-	//uint64_t idx = 0;
+	// The tails of the last groups of layers and z-slices are never sampled, they are zeroed to be saved to the world cache
+	std::fill(curMapTexture, curMapTexture + GetMapTextureBytes(), 0);
+	std::fill(curLightMapTexture, curLightMapTexture + GetLightTextureBytes(), 0);
 	for (int x = 0; x < size.x; x++)
 		for (int y = 0; y < size.y; y++)
 			for (int z = 0; z < size.z; z++)
 				for (int w = 0; w < size.w; w++)
 				{
-					int FieldIdx = GetIndex(x, y, z, w);
-					int TexIdx = GetTexIndex(x, y, z, w);
-					curMapTexture[TexIdx] = 0; //no block by default
-					curMapTexture[TexIdx + 1] = 0; 
-					curMapTexture[TexIdx + 2] = 0; 
-					curMapTexture[TexIdx + 3] = 0;
-
-					if ((curMap[FieldIdx] & WALL_BLOCK) != 0)
-					{
-						curMapTexture[TexIdx] = 255; // fully solid block
-						curMapTexture[TexIdx + 1] = 10; //regular block type
-					}
-					if ((curMap[FieldIdx] & LIGHT_BLOCK) != 0)
-					{
-						curMapTexture[TexIdx] = 255; // fully solid block
-						curMapTexture[TexIdx + 1] = 255; //light block type
-					}
+					int64_t TexIdx = GetTexIndex(x, y, z, w);
+					PackCube(GetIndex(x, y, z, w), curMapTexture[TexIdx], &curLightMapTexture[4 * TexIdx]);
+				}
 
-					Light_t light = curLightMap[FieldIdx];
-					int LightLevelNegX = ((light >> (NEG_X * 4)) & (Texture::LIGHT_GRAD - 1));
-					int LightLevelPosX = ((light >> (POS_X * 4)) & (Texture::LIGHT_GRAD - 1));
-					int LightLevelNegY = ((light >> (NEG_Y * 4)) & (Texture::LIGHT_GRAD - 1));
-					int LightLevelPosY = ((light >> (POS_Y * 4)) & (Texture::LIGHT_GRAD - 1));
-					int LightLevelNegZ = ((light >> (NEG_Z * 4)) & (Texture::LIGHT_GRAD - 1));
-					int LightLevelPosZ = ((light >> (POS_Z * 4)) & (Texture::LIGHT_GRAD - 1));
-					int LightLevelNegW = ((light >> (NEG_W * 4)) & (Texture::LIGHT_GRAD - 1));
-					int LightLevelPosW = ((light >> (POS_W * 4)) & (Texture::LIGHT_GRAD - 1));
-					
-					if (LightLevelPosX > 0)
-						int i = 0;
-					curLightMapTexture[TexIdx + 0] =  LightLevelPosX * 16 + LightLevelNegX;
-					curLightMapTexture[TexIdx + 1] =  LightLevelPosY * 16 + LightLevelNegY;
-					curLightMapTexture[TexIdx + 2] =  LightLevelPosZ * 16 + LightLevelNegZ;
-					curLightMapTexture[TexIdx + 3] =  LightLevelPosW * 16 + LightLevelNegW;
+	curMapTexture[0] = MAP_TEXEL_REGULAR;
+}
 
-				}
+void Field::UploadTextures(Shader* shader, const uint8_t* curMapTexture, const uint8_t* curLightMapTexture)
+{
+	ShaderSettings::GetInstance()->SetMapSize(glm::ivec4(size.x, size.y, size.z, size.w), GetTextureZSlices());
 
-	
-	int idx = GetTexIndex(9,4,4,11);
-	idx = 0;
-	curMapTexture[idx + 0] = 255;
-	curMapTexture[idx + 1] = 10;
-	curMapTexture[idx + 2] = 0;
-	curMapTexture[idx + 3] = 0;
+	glm::ivec3 texSize = GetTextureSize();
+	int texSizeX = texSize.x;
+	int texSizeY = texSize.y;
+	int texSizeZ = texSize.z;
 
-	GLuint newCurMapTextureId;
-	glActiveTexture(GL_TEXTURE0 + 1);
-	glGenTextures(1, &newCurMapTextureId);
-	glBindTexture(GL_TEXTURE_3D, newCurMapTextureId);
-	// set the texture wrapping parameters
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);	// set texture wrapping to GL_REPEAT (default wrapping method)
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	// set texture filtering parameters
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); //GL_NEAREST GL_LINEAR
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	
+	// Layers always fit, as MAP_TEXTURE_LAYERS is the least limit, the height fits unless a single z-slice
+	// is too high, but the width may not
+	GLint maxTextureSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+	if (texSizeX > maxTextureSize || texSizeY > maxTextureSize)
+		CriticalError("The maze is too big for the GL textures, please decrease maze_size or room_size");
 
-	glUseProgram(shader->ID);
-	GLint curMapId = glGetUniformLocation(shader->ID, "currentMap");
-	glUniform1i(curMapId, 1); // Texture unit 4 is for current map.
+	if (mapTextureId == 0)
+	{
+		glActiveTexture(GL_TEXTURE0 + 1);
+		glGenTextures(1, &mapTextureId);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, mapTextureId);
+		// set the texture wrapping parameters
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);	// set texture wrapping to GL_REPEAT (default wrapping method)
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		// set texture filtering parameters
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST); //GL_NEAREST GL_LINEAR
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		shader->use();
+		shader->setInt(UNIFORM_CURRENT_MAP, 1); // Texture unit 1 is for current map.
+
+		glActiveTexture(GL_TEXTURE0 + 2);
+		glGenTextures(1, &lightMapTextureId);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, lightMapTextureId);
+		// set the texture wrapping parameters
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);	// set texture wrapping to GL_REPEAT (default wrapping method)
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		// set texture filtering parameters
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		shader->setInt(UNIFORM_CURRENT_LIGHT_MAP, 2); // Texture unit 2 is for the light map.
+	}
 
-	glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, texSizeX, texSizeY, texSizeZ, 0, GL_RGBA, GL_UNSIGNED_BYTE, curMapTexture);
+	// The storage is only reallocated when the size changes (the win room)
+	bool isResized = textureSize != texSize;
+	textureSize = texSize;
 
+	// Rows of the one byte texels are not aligned to 4 bytes
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glActiveTexture(GL_TEXTURE0 + 1);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, mapTextureId);
+	if (isResized)
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R8UI, texSizeX, texSizeY, texSizeZ, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, curMapTexture);
+	else
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, texSizeX, texSizeY, texSizeZ, GL_RED_INTEGER, GL_UNSIGNED_BYTE, curMapTexture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
-	GLuint newCurLightMapTextureId;
 	glActiveTexture(GL_TEXTURE0 + 2);
-	glGenTextures(1, &newCurLightMapTextureId);
-	glBindTexture(GL_TEXTURE_3D, newCurLightMapTextureId);
-	// set the texture wrapping parameters
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);	// set texture wrapping to GL_REPEAT (default wrapping method)
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	// set texture filtering parameters
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-	GLint curMapLightId = glGetUniformLocation(shader->ID, "currentLightMap");
-	glUseProgram(shader->ID);
-	glUniform1i(curMapLightId, 2); // Texture unit 4 is for current map.
+	glBindTexture(GL_TEXTURE_2D_ARRAY, lightMapTextureId);
+	if (isResized)
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, texSizeX, texSizeY, texSizeZ, 0, GL_RGBA, GL_UNSIGNED_BYTE, curLightMapTexture);
+	else
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, texSizeX, texSizeY, texSizeZ, GL_RGBA, GL_UNSIGNED_BYTE, curLightMapTexture);
+}
 
-	glActiveTexture(GL_TEXTURE0 + 2);
-	glBindTexture(GL_TEXTURE_3D, newCurLightMapTextureId);
-	glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, texSizeX, texSizeY, texSizeZ, 0, GL_RGBA, GL_UNSIGNED_BYTE, curLightMapTexture);
-	
-	delete[] curMapTexture;
-	delete[] curLightMapTexture;
+void Field::UpdateTextures(const FieldBox& box)
+{
+	FieldBox mapBox;
+	mapBox.from = glm::max(box.from, glm::ivec4(0));
+	mapBox.to = glm::min(box.to, size);
+	if (mapTextureId == 0 || mapBox.IsEmpty())
+		return;
 
+	// Within a z-slice and a group of layers the box is a box of texels: x, y and w
+	glm::ivec4 from = mapBox.from;
+	glm::ivec4 to = mapBox.to;
+	glm::ivec4 boxSize = to - from;
+	std::vector<uint8_t> mapTexels(int64_t(boxSize.x) * boxSize.y * glm::min(boxSize.w, MAP_TEXTURE_LAYERS));
+	std::vector<uint8_t> lightTexels(4 * mapTexels.size());
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (int z = from.z; z < to.z; z++)
+		for (int groupFrom = from.w; groupFrom < to.w; )
+		{
+			int groupTo = glm::min(((groupFrom >> MAP_TEXTURE_LAYERS_BITS) + 1) << MAP_TEXTURE_LAYERS_BITS, to.w);
+			int64_t i = 0;
+			for (int w = groupFrom; w < groupTo; w++)
+				for (int y = from.y; y < to.y; y++)
+					for (int x = from.x; x < to.x; x++, i++)
+						PackCube(GetIndex(x, y, z, w), mapTexels[i], &lightTexels[4 * i]);
+
+			glm::ivec3 texFrom = GetTexel(from.x, from.y, z, groupFrom);
+			glActiveTexture(GL_TEXTURE0 + 1);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, mapTextureId);
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, texFrom.x, texFrom.y, texFrom.z, boxSize.x, boxSize.y, groupTo - groupFrom,
+				GL_RED_INTEGER, GL_UNSIGNED_BYTE, mapTexels.data());
+			glActiveTexture(GL_TEXTURE0 + 2);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, lightMapTextureId);
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, texFrom.x, texFrom.y, texFrom.z, boxSize.x, boxSize.y, groupTo - groupFrom,
+				GL_RGBA, GL_UNSIGNED_BYTE, lightTexels.data());
+
+			groupFrom = groupTo;
+		}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 }
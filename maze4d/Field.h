@@ -2,29 +2,77 @@
 
 #include <glad/glad.h>
 #include <shader.h>
+#include <ShaderSettings.h>
 
 #include <Texture.h>
 #include <Maze.h>
+#include <BrickStore.h>
+#include <WorldCache.h>
+
+#include <unordered_map>
+#include <algorithm>
 
 
 #define WALL_BLOCK  (1 << 0)
 #define LIGHT_BLOCK (1 << 1)
 #define WIN_BLOCK   (1 << 2)
 
+// Texel of the GL map texture (R8UI): the distance (see GetDistance) for the empty cube,
+// which is below MAP_TEXEL_REGULAR, or the type of the non-empty cube
+#define MAP_TEXEL_REGULAR 128
+#define MAP_TEXEL_LIGHT   255
+
+// GL map textures are 2D texture arrays: w is the layer and z-slices are stacked along y,
+// so a step along any axis moves the texel by a constant. Bigger w is split into groups
+// of MAP_TEXTURE_LAYERS, the least GL_MAX_ARRAY_TEXTURE_LAYERS, and bigger z into groups of
+// the slices, which fit into MAP_TEXTURE_HEIGHT, the least GL_MAX_TEXTURE_SIZE. The groups are placed along x.
+#define MAP_TEXTURE_LAYERS_BITS 8
+#define MAP_TEXTURE_LAYERS (1 << MAP_TEXTURE_LAYERS_BITS)
+#define MAP_TEXTURE_HEIGHT 1024
+
 typedef uint8_t Cell_t;
 typedef uint32_t Light_t;
 
-typedef Cell_t* Map_t;
-typedef Light_t* LightMap_t;
+typedef BrickStore<Cell_t> Map_t;
+typedef BrickStore<Light_t> LightMap_t;
+typedef BrickStore<uint8_t> DistanceMap_t;
+
+// Box of cubes [from, to), empty by default
+struct FieldBox
+{
+	glm::ivec4 from = glm::ivec4(INT32_MAX);
+	glm::ivec4 to = glm::ivec4(INT32_MIN);
+
+	bool IsEmpty() const { return glm::any(glm::greaterThanEqual(from, to)); }
+
+	void Add(const glm::ivec4 pos)
+	{
+		from = glm::min(from, pos);
+		to = glm::max(to, pos + 1);
+	}
+
+	void Add(const FieldBox& box)
+	{
+		from = glm::min(from, box.from);
+		to = glm::max(to, box.to);
+	}
+};
 
 
 class Field
 {
 public:
-	Field(const glm::ivec4 size, const int lightDist, const int roomSize);
+	Field(const glm::ivec4 size, const int lightDist, const int roomSize, const int layout = BRICK_LAYOUT_TILED);
 	~Field();
 
-	void Init(Maze* maze, Shader* shader);
+	// Generates the field from the maze, and saves it to the world cache if it is given
+	void Init(Maze* maze, Shader* shader, WorldCache* worldCache = nullptr);
+
+	// Cells and light only, without GL textures
+	void Generate(Maze* maze);
+
+	// Loads the field saved by Init instead of the generation, false if the cache is missing or stale
+	bool Load(WorldCache* worldCache, Shader* shader);
 	
 	void CreateWinRoom();
 
@@ -32,15 +80,52 @@ public:
 
 	bool IsCubeIndexValid(int x, int y, int z, int w);
 
-	int GetIndex(const int x, const int y, const int z, const int w);
+	int64_t GetIndex(const int x, const int y, const int z, const int w);
+
+	// Fast access by index from GetIndex
+	Cell_t GetCell(const int64_t index) { return curMap->Get(index); }
+	Light_t GetLight(const int64_t index) { return curLightMap->Get(index); }
+
+	// Chebyshev distance from the cube to the nearest non-empty cube (0 for it), at most distanceMax.
+	// Cubes outside of the map count as non-empty.
+	// All cubes closer than the distance are empty, so a ray can leap over them.
+	uint8_t GetDistance(const int64_t index) { return curDistanceMap->Get(index); }
+
+	// Index of the cube moved along the axis, faster than GetIndex for the neighbours
+	int64_t MoveIndex(const int64_t index, const int axis, const int from, const int to) { return curMap->MoveIndex(index, axis, from, to); }
 
-	Map_t curMap;
-	LightMap_t curLightMap;
+	Map_t* curMap;
+	LightMap_t* curLightMap;
+	DistanceMap_t* curDistanceMap;
 
 	const int roomSize;
 
 	void LoadMazeToGL(Shader* shader);
 
+	// GL textures of the map: cubes, R8UI, fetched on every DDA step,
+	// and light of the wall sides, RGBA8, fetched only when the ray hits a wall.
+	// Both are 2D arrays (see MAP_TEXTURE_LAYERS), the size is width, height and layers.
+	glm::ivec3 GetTextureSize();
+	// Number of z-slices in a group, which are stacked along y
+	int GetTextureZSlices();
+	// Texel of the cube in the textures: x, y and the layer (same as GetMapTexel in the shader)
+	glm::ivec3 GetTexel(const int x, const int y, const int z, const int w);
+	uint64_t GetMapTextureBytes();
+	uint64_t GetLightTextureBytes();
+	void PackTextures(uint8_t* curMapTexture, uint8_t* curLightMapTexture);
+	// The textures are created once and reused by the next uploads, e.g. for the win room
+	void UploadTextures(Shader* shader, const uint8_t* curMapTexture, const uint8_t* curLightMapTexture);
+	// Repacks the cubes of the box and uploads only them to the GL textures, e.g. after AddLight
+	void UpdateTextures(const FieldBox& box);
+
+	// Changes of the main map with incremental relighting: light is recomputed only within
+	// lightDist of the changed cube. Return the box of cubes whose cell or light has changed,
+	// empty if the change is not possible (e.g. the light on a wall).
+	FieldBox AddLight(const glm::ivec4 pos);
+	FieldBox RemoveLight(const glm::ivec4 pos);
+	FieldBox MoveLight(const glm::ivec4 from, const glm::ivec4 to);
+	FieldBox SetWall(const glm::ivec4 pos, const bool isWall);
+
 	glm::ivec4 size;
 
 private:
@@ -51,22 +136,65 @@ private:
 
 	void CreateExit(Maze* maze);
 
-	void GenerateWalls(Maze* maze);
+	// Room layers [fromX, toX)
+	void GenerateWalls(Maze* maze, int fromX, int toX);
+
+	void GenerateLight(Maze* maze, int fromX, int toX);
+
+	void GenerateMapEdgesLight();
+
+	// Sets the light of the wall sides, which are the map edges
+	void SetMapEdgesLight(const glm::ivec4 pos, Light_t& light);
+
+	// Light levels [0, lightDist] scaled to the wall side light
+	std::vector<unsigned int> GetScaledLightLevels();
+
+	// Voxelizes the maze while it is generated layer by layer
+	void GenerateStreamed(Maze* maze);
 
-	void GenerateLight(Maze* maze);
+	// Spreads lights [firstLight, lights.size()) to the walls around them
+	void PropagateLight(const size_t firstLight);
+	void PropagateLight(const size_t firstLight, const int fromX, const int toX,
+		const std::unordered_map<int64_t, int>& lightOrder, const std::vector<unsigned int>& scaledLevels);
 
-	void GenerateLightRecursive(int px, int py, int pz, int pw, unsigned int level, int side);
+	// Recomputes the light of the walls, which light paths through the center cube may reach
+	FieldBox Relight(const glm::ivec4 center);
+
+	// Distances of the cubes [from, to), returns the box of the changed ones
+	FieldBox ComputeDistances(const glm::ivec4 from, const glm::ivec4 to);
+	// Distances of the cubes [from, to) of one slab along x, with the cubes of the region [regionFrom, regionTo) around
+	FieldBox ComputeSlabDistances(const glm::ivec4 from, const glm::ivec4 to, const glm::ivec4 regionFrom, const glm::ivec4 regionTo);
+	// Distances around the changed center cube
+	FieldBox UpdateDistances(const glm::ivec4 center);
+
+	// Field state and the random engine state after the generation
+	void Save(WorldCache* worldCache, const uint8_t* curMapTexture, const uint8_t* curLightMapTexture);
+
+	// Texels of the cube at the index (see PackTextures)
+	void PackCube(const int64_t index, uint8_t& mapTexel, uint8_t* lightTexel);
+
+	// GL textures, 0 until the first upload, and their size
+	GLuint mapTextureId = 0;
+	GLuint lightMapTextureId = 0;
+	glm::ivec3 textureSize = glm::ivec3(0);
 
 	
-	const int totalSize;
+	const int64_t totalSize;
 	const int lightDist;
+	// Distances are capped by the half of the room, which is the farthest cube from the walls in the room
+	const int distanceMax;
 	int cubesCount = 0;
 
-	Map_t map;
-	LightMap_t lightMap;
+	// Positions of the light cubes in the order they were placed
+	std::vector<glm::ivec4> lights;
+
+	Map_t* map;
+	LightMap_t* lightMap;
+	DistanceMap_t* distanceMap;
 
-	Map_t winMap;
-	LightMap_t winLightMap;
+	Map_t* winMap;
+	LightMap_t* winLightMap;
+	DistanceMap_t* winDistanceMap;
 
 	const glm::ivec4 winMapSize = glm::ivec4(9, 9, 9, 9);
 };
@@ -1,31 +1,70 @@
 #version 330 core
 
-out vec4 FragColor;
+#ifdef COMPUTE_RAYCASTING
+//compute shader variant (see Shader::LoadComputeFromFile): a workgroup traces a tile of 8x8 pixels to the image
+layout(local_size_x = 8, local_size_y = 8) in;
+layout(rgba8, binding = 0) uniform writeonly image2D frameImage; //Image0
+
+layout(r32ui, binding = 1) uniform uimage2D hitImage; //Image1
+
+//temporal anti-aliasing: the history of the previous frames is in historyImage,
+//their hits in historyHitImage and the history with this frame goes to newHistoryImage
+layout(rgba16f, binding = 2) uniform readonly image2D historyImage; //Image2
+layout(rgba16f, binding = 3) uniform writeonly image2D newHistoryImage; //Image3
+layout(r32ui, binding = 4) uniform readonly uimage2D historyHitImage; //Image4
+#else
+//the frame buffer of the passes of the anti-aliasing has the hit (see GameGraphics::RaycastFragment)
+//and the history with this frame of the temporal anti-aliasing as the next attachments
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out uint FragHitId;
+layout(location = 2) out vec4 FragHistory;
 in vec3 ourColor;
 in vec2 TexCoord;
+uniform usampler2D hitMap; //Texture3, the hits of the first pass for the second one
+uniform sampler2D historyMap; //Texture4, the history of the previous frames
+uniform usampler2D historyHitMap; //Texture5, their hits
+#endif
+
+//temporal anti-aliasing: the ray goes through the pixel center moved by the jitter (-0.5...0.5 pixels),
+//the history of the previous frames has rgb and the number of frames in alpha
+uniform int TemporalHistory = 0; //0 - no history: the first frame or a new image size
+uniform vec2 TemporalJitter = vec2(0.0f, 0.0f);
+
+//the history is the average of the last frames, up to this number
+const float TEMPORAL_MAX_FRAMES = 16.0f;
+//the hit point is seen by the history camera, if it is in its 3d slice: up to this distance along its w (rounding errors)
+const float TEMPORAL_MAX_W_OFFSET = 0.001f;
+
+//adaptive anti-aliasing in two passes: 1 - one ray per pixel, its hit goes to the hit image;
+//2 - all the samples only for the pixels, whose hit differs from a neighbour's. 0 - all the samples in one pass;
+//3 - temporal anti-aliasing (see GetTemporalPixel)
+uniform int AntiAliasingPass = 0;
 
 //buffer with CPU rendered picture (legacy)
 uniform sampler2D texture1; //Texture0
 
-//list of 4d coordinates encoded into 3-dimensional texture
-//Special function converts 4d to 3d index
-//Function name: ivec3 Convert4dIdxTo3dIdx(ivec4 Idx4)
-uniform sampler3D currentMap; //Texture1
-uniform sampler3D currentLightMap; //Texture2
+//4d map encoded into 2d texture arrays, the texel of the cube is given by GetMapTexel
+//cube texel: the distance to the nearest non-empty cube for the empty cube (all cubes closer than it are empty),
+//MAP_TEXEL_REGULAR or MAP_TEXEL_LIGHT for the others
+uniform usampler2DArray currentMap; //Texture1
+uniform sampler2DArray currentLightMap; //Texture2
 
-//technical parameters to help with 4d->3d conversion
-uniform ivec3 MapWnAddedSize;
-uniform ivec3 MapTexSize;
-
-uniform ivec4 mapSize;
-uniform ivec2 gameResolution; //viewWidth and viewHeight
-
-uniform int CpuRender = 1;
-uniform int AntiAliasingEnabled = 0;
+//settings, which change only with the maze or the config (see ShaderSettings.h)
+layout(std140) uniform Settings
+{
+	ivec4 mapSize;
+	ivec2 gameResolution; //viewWidth and viewHeight
+	int CpuRender;
+	int AntiAliasingEnabled;
+	int mapZSlices; //z-slices in a group of the map texture
+	int mapZGroups;
+};
 const int  EDGES_COUNT = 8;
 
-//regular 4d Cube texture, contains 8 textures of solid 3d cubes
+//regular 4d Cube texture, contains 8 textures of solid 3d cubes.
+//The light is baked in (see Cube::LoadToGL): the cube of the light level l is the z slab l of the texture
 uniform sampler3D edge3dCube[8]; //Textures50-57
+const int LIGHT_GRAD = 16;
 
 uniform sampler3D light3dCube; //texture of the light cube 
 
@@ -36,98 +75,111 @@ const int  NEG_Z = 4; const int  POS_Z = 5;
 const int  NEG_W = 6; const int  POS_W = 7;
 const int  NULL_EDGE = 8; 
 
-//Rotation matrix
-uniform vec4 vx = vec4(1.0f, 0.0f, 0.0f, 0.0f);
-uniform vec4 vy = vec4(0.0f, 1.0f, 0.0f, 0.0f);
-uniform vec4 vz = vec4(0.0f, 0.0f, 1.0f, 0.0f);
-uniform vec4 vw = vec4(0.0f, 0.0f, 0.0f, 1.0f);
+//hit of the ray (see GetRaycastPixel) for the rays, which leave the map, and for the pixels of the CPU frame
+const uint HIT_OUTSIDE = 0xFFFFFFFFu;
+const uint HIT_CPU_FRAME = 0xFFFFFFFEu;
 
-//player position
-uniform vec4 pos = vec4(4.2f, 4.2f, 4.2f, 4.2f);
+//same as in Field.h
+const uint MAP_TEXEL_REGULAR = 128u;
+const uint MAP_TEXEL_LIGHT = 255u;
+const int  MAP_TEXTURE_LAYERS_BITS = 8;
+const int  MAP_TEXTURE_LAYERS = 1 << MAP_TEXTURE_LAYERS_BITS;
 
-ivec3 Convert4dIdxTo3dIdx(ivec4 Idx4)
+//cameras of the views, which are rendered in one pass (see ViewBuffer.h): the main view and the insets over it.
+//The pixel belongs to the last view, whose rectangle has it: xy - corner, zw - size in the texture coordinates of the frame
+const int MAX_VIEWS = 4;
+layout(std140) uniform Views
 {
-	int texWxMax = MapWnAddedSize.x;
-	int texWyMax = MapWnAddedSize.y;
-	int texWzMax = MapWnAddedSize.z;
-
-	int texWz = Idx4.w / (texWxMax*texWyMax);
-	int texWy = (Idx4.w % (texWxMax*texWyMax)) / texWxMax;
-	int texWx = (Idx4.w % (texWxMax*texWyMax)) % texWxMax;
-
-	int texX = texWx * mapSize.x + Idx4.x;
-	int texY = texWy * mapSize.y + Idx4.y;
-	int texZ = texWz * mapSize.z + Idx4.z;
-
-	return ivec3(texX, texY, texZ);
+	vec4 viewRect[MAX_VIEWS];
+	vec4 viewVx[MAX_VIEWS];
+	vec4 viewVy[MAX_VIEWS];
+	vec4 viewVz[MAX_VIEWS];
+	vec4 viewVw[MAX_VIEWS];
+	vec4 viewPos[MAX_VIEWS];
+	//cameras of the previous frame, for the temporal anti-aliasing
+	vec4 historyVx[MAX_VIEWS];
+	vec4 historyVy[MAX_VIEWS];
+	vec4 historyVz[MAX_VIEWS];
+	vec4 historyVw[MAX_VIEWS];
+	vec4 historyPos[MAX_VIEWS];
+	int viewCount;
+};
+
+//camera of the view of the pixel (see SetView): rotation matrix and player position
+int view = 0;
+vec4 vx;
+vec4 vy;
+vec4 vz;
+vec4 vw;
+vec4 pos;
+
+int FindView(vec2 TexCoord)
+{
+	for (int i = viewCount - 1; i > 0; i--)
+		if (all(greaterThanEqual(TexCoord, viewRect[i].xy)) && all(lessThan(TexCoord, viewRect[i].xy + viewRect[i].zw)))
+			return i;
+	return 0;
 }
 
-vec3 rgb2hsv(vec3 c)
+void SetView(int i)
 {
-	vec4 K = vec4(0.0, -1.0 / 3.0, 2.0 / 3.0, -1.0);
-	vec4 p = mix(vec4(c.bg, K.wz), vec4(c.gb, K.xy), step(c.b, c.g));
-	vec4 q = mix(vec4(p.xyw, c.r), vec4(c.r, p.yzx), step(p.x, c.r));
-
-	float d = q.x - min(q.w, q.y);
-	float e = 1.0e-10;
-	return vec3(abs(q.z + (q.w - q.y) / (6.0 * d + e)), d / (q.x + e), q.x);
+	view = i;
+	vx = viewVx[i];
+	vy = viewVy[i];
+	vz = viewVz[i];
+	vw = viewVw[i];
+	pos = viewPos[i];
 }
 
-// All components are in the range [01], including hue.
-vec3 hsv2rgb(vec3 c)
+//texture coordinates of the frame to the screen of the view
+vec2 GetViewTexCoord(vec2 TexCoord)
 {
-	vec4 K = vec4(1.0, 2.0 / 3.0, 1.0 / 3.0, 3.0);
-	vec3 p = abs(fract(c.xxx + K.xyz) * 6.0 - K.www);
-	return c.z * mix(K.xxx, clamp(p - K.xxx, 0.0, 1.0), c.y);
+	return (TexCoord - viewRect[view].xy) / viewRect[view].zw;
 }
 
+//w is the layer, z-slices are stacked along y (see Field.h), so a step along any axis
+//moves the texel by a constant and the DDA keeps it with a single add
+//until it leaves the group of layers or z-slices
+ivec3 GetMapTexel(ivec4 map)
+{
+	int zGroup = map.z / mapZSlices;
+	int group = (map.w >> MAP_TEXTURE_LAYERS_BITS) * mapZGroups + zGroup;
+	return ivec3(map.x + group * mapSize.x, (map.z - zGroup * mapZSlices) * mapSize.y + map.y, map.w & (MAP_TEXTURE_LAYERS - 1));
+}
 
 ivec3 GetMapIndex(int x, int y, int z, int w)
 {
-	return Convert4dIdxTo3dIdx(ivec4(x,y,z,w));
+	return GetMapTexel(ivec4(x,y,z,w));
 }
 
-float GetLightLevelByIndex(int edge, ivec3 idx)
+int GetLightLevelByIndex(int edge, ivec3 idx)
 {
-	vec4 pixel = texelFetch(currentLightMap, idx, 0);
+	//the bytes are rounded, the nibbles of the light levels must not be shifted
+	ivec4 pixel = ivec4(round(texelFetch(currentLightMap, idx, 0) * 255.0f));
 
 	int value = 0;
 
 	if (edge == NEG_X)
-		value = int(pixel.x * 255) % 16;
+		value = pixel.x % 16;
 	if (edge == POS_X)
-		value = int(pixel.x * 255) / 16;
+		value = pixel.x / 16;
 
 	if (edge == NEG_Y)
-		value = int(pixel.y * 255) % 16;
+		value = pixel.y % 16;
 	if (edge == POS_Y)
-		value = int(pixel.y * 255) / 16;
+		value = pixel.y / 16;
 
 	if (edge == NEG_Z)
-		value = int(pixel.z * 255) % 16;
+		value = pixel.z % 16;
 	if (edge == POS_Z)
-		value = int(pixel.z * 255) / 16;
+		value = pixel.z / 16;
 
 	if (edge == NEG_W)
-		value = int(pixel.w * 255) % 16;
+		value = pixel.w % 16;
 	if (edge == POS_W)
-		value = int(pixel.w * 255) / 16;
-	
-	value = value + 1; //to make it the same as CPU-based light
-	return value/15.0f;
-}
+		value = pixel.w / 16;
 
-vec4 ApplyLight(vec4 colRGBA, float lightLevel)
-{
-	vec3 colHSV = rgb2hsv(colRGBA.xyz);
-	float minValue = 0.15f; //Light cannot be less that 15%
-	if (lightLevel < minValue)
-		lightLevel = minValue;
-	colHSV.z = colHSV.z * lightLevel;
-	vec3 colRGB = hsv2rgb(colHSV);
-	vec4 result = vec4(colRGB.x, colRGB.y, colRGB.z, colRGBA.w);
-
-	return result;
+	return value;
 }
 
 bool IsCubeIndexValid(int x, int y, int z, int w)
@@ -139,8 +191,8 @@ bool IsCubeIndexValid(int x, int y, int z, int w)
 		w >= 0 && w < mapSize.w);
 }
 
-//based on x,y screen position
-vec4 GetRaycastVector(vec2 texCoord)
+//ray of the camera through the screen point
+vec4 GetScreenRay(vec2 texCoord)
 {
 	//Raycast vector and positioning
 	float W2 = gameResolution.x / 2.0f;
@@ -153,7 +205,31 @@ vec4 GetRaycastVector(vec2 texCoord)
 	vec4 dY = 2 * vy * screenOffset.y;
 	vec4 rayVforward = vx;
 
-	vec4 v = rayVforward + dX + dY;
+	return rayVforward + dX + dY;
+}
+
+#ifdef COMPUTE_RAYCASTING
+//ray setup of the tile, shared by its pixels of the same view (see main):
+//the ray of the tile corner (at tileTexCoord of its view) and its change along the screen axes
+shared int tileView;
+shared vec2 tileTexCoord;
+shared vec4 tileRay;
+shared vec4 tileRayDX;
+shared vec4 tileRayDY;
+#endif
+
+//based on x,y screen position of the view
+vec4 GetRaycastVector(vec2 texCoord)
+{
+#ifdef COMPUTE_RAYCASTING
+	vec4 v;
+	if (view == tileView)
+		v = tileRay + tileRayDX * (texCoord.x - tileTexCoord.x) + tileRayDY * (texCoord.y - tileTexCoord.y);
+	else
+		v = GetScreenRay(texCoord);
+#else
+	vec4 v = GetScreenRay(texCoord);
+#endif
 
 	//OpenGL can't properly work with infinity when divide to Zero 
 	float epsilon = 0.00001f;
@@ -165,7 +241,7 @@ vec4 GetRaycastVector(vec2 texCoord)
 	return v;
 }
 
-vec4 GetPixelFromTexture(ivec4 map, vec4 raycastVec, int edge, ivec4 step, int blockType, float lightLevel = 1.0f)
+vec4 GetPixelFromTexture(ivec4 map, vec4 raycastVec, int edge, ivec4 step, int blockType, int lightLevel)
 {
 	float dist = 0.0f;
 	vec3 texPoint;
@@ -196,8 +272,10 @@ vec4 GetPixelFromTexture(ivec4 map, vec4 raycastVec, int edge, ivec4 step, int b
 	//regular block type
 	if (blockType == 10)
 	{
-		CubePixel = texture(edge3dCube[edge], texPoint, 0);
-		CubePixel = ApplyLight(CubePixel, lightLevel);
+		//z repeats inside the slab of the light level, the smoothering doesn't reach the next slab
+		float halfTexel = 0.5f / float(textureSize(edge3dCube[edge], 0).x);
+		float z = clamp(fract(texPoint.z), halfTexel, 1.0f - halfTexel);
+		CubePixel = texture(edge3dCube[edge], vec3(texPoint.xy, (float(lightLevel) + z) / float(LIGHT_GRAD)));
 	}
 	//light block type
 	else
@@ -208,9 +286,42 @@ vec4 GetPixelFromTexture(ivec4 map, vec4 raycastVec, int edge, ivec4 step, int b
 	return CubePixel;
 }
 
+//distance of the n-th DDA step along the axis, summed the same way as the DDA does
+float GetStepDist(vec4 sideDist, vec4 deltaDist, int axis, int n)
+{
+	float dist = sideDist[axis];
+	for (int i = 1; i < n; i++)
+		dist += deltaDist[axis];
+	return dist;
+}
+
+//makes all the DDA steps before the given one, DDA steps along the lower axis first on the same distance
+void SkipSteps(inout vec4 sideDist, inout ivec4 map, vec4 deltaDist, ivec4 step, float stopDist, int stopSide)
+{
+	for (int a = 0; a < 4; a++)
+		while (sideDist[a] < stopDist || (sideDist[a] == stopDist && a < stopSide))
+		{
+			sideDist[a] += deltaDist[a];
+			map[a] += step[a];
+		}
+}
+
+//id of the cube side, which the ray has stopped at, for the comparison with the neighbour pixels
+uint GetHitId(ivec4 map, int edge)
+{
+	if (!IsCubeIndexValid(map.x, map.y, map.z, map.w))
+		return HIT_OUTSIDE;
+	uint hash = uint(map.x) * 73856093u ^ uint(map.y) * 19349663u ^ uint(map.z) * 83492791u ^ uint(map.w) * 2971215073u;
+	return (hash << 3) | uint(edge);
+}
+
 // uses DDA algo (from https://lodev.org/cgtutor/raycasting.html)
-vec4 GetRaycastPixel(vec4 raycastVector)
+//hitDist is the distance along the ray to its hit (-1 if it misses the map)
+vec4 GetRaycastPixel(vec4 raycastVector, out uint hitId, out float hitDist)
 {
+	hitId = HIT_OUTSIDE;
+	hitDist = -1.0f;
+
 	
 	ivec4 map = ivec4(floor(pos));
 	vec4 v = raycastVector; //based on x,y screen position
@@ -218,72 +329,125 @@ vec4 GetRaycastPixel(vec4 raycastVector)
 	vec4 deltaDist = vec4(abs(1.0f / v.x), abs(1.0f / v.y), abs(1.0f / v.z), abs(1.0f / v.w));
 	vec4 sideDist = (map - pos + (1 + step) / 2.0f) * step * deltaDist; //what direction to step in x or y-direction (either +1 or -1)
 
-	vec4 cell = vec4(0.0f, 0.0f, 0.0f, 0.0f);;
+	uint cell = 0u;
 	vec4 CubePixel = vec4(0.0f, 0.0f, 0.0f, 0.0f);
 
 	int edge = 0;
-	int outRangeDistance = 0;
-	int outRangeMaxDistance = mapSize.x + mapSize.y + mapSize.z + mapSize.w;
 
 	int blockType = 0;
 
 	int prevEdge = -1;
 	int prevBlockType = -1;
-	float lightLevel = 0.0f;
-	float prevLightLevel = 0.0f;
+	int lightLevel = 0;
+	int prevLightLevel = 0;
+
+	//from outside of the map (noclip) go straight to the step into the map:
+	//the last of the axes to get in range, unless some axis gets out of range before
+	if (!IsCubeIndexValid(map.x, map.y, map.z, map.w))
+	{
+		float enterDist = -1.0f;
+		int enterSide = 0;
+		float leaveDist = 0.0f;
+		int leaveSide = -1;
+		for (int a = 0; a < 4; a++)
+		{
+			int enterSteps = map[a] < 0 ? -map[a] : max(map[a] - (mapSize[a] - 1), 0);
+			if (enterSteps > 0 && (map[a] < 0) != (step[a] > 0))
+				return vec4(1.0f, 1.0f, 1.0f, 1.0f); //moving away from the map
+
+			if (enterSteps > 0)
+			{
+				float dist = GetStepDist(sideDist, deltaDist, a, enterSteps);
+				if (dist >= enterDist)
+				{
+					enterDist = dist;
+					enterSide = a;
+				}
+			}
+
+			float dist = GetStepDist(sideDist, deltaDist, a, step[a] > 0 ? mapSize[a] - map[a] : map[a] + 1);
+			if (leaveSide < 0 || dist < leaveDist)
+			{
+				leaveDist = dist;
+				leaveSide = a;
+			}
+		}
+
+		if (leaveDist < enterDist || (leaveDist == enterDist && leaveSide < enterSide))
+			return vec4(1.0f, 1.0f, 1.0f, 1.0f); //misses the map
+
+		SkipSteps(sideDist, map, deltaDist, step, enterDist, enterSide);
+	}
+
+	ivec3 texel = GetMapTexel(map);
 
 	//perform DDA
 	while (true)
 	{
 		vec4 hitPixel = vec4(0.0f, 0.0f, 0.0f, 0.0f);
 		blockType = 0;
+		int distance = 0;
 
 		//jump to next map square, OR in x-direction, OR in y-direction
 		if (sideDist.x <= sideDist.y && sideDist.x <= sideDist.z && sideDist.x <= sideDist.w)
 		{
 			sideDist.x += deltaDist.x;
 			map.x += step.x;
+			texel.x += step.x;
 			edge = pos.x < map.x ? NEG_X : POS_X;
 		}
 		else if (sideDist.y <= sideDist.x && sideDist.y <= sideDist.z && sideDist.y <= sideDist.w)
 		{
 			sideDist.y += deltaDist.y;
 			map.y += step.y;
+			texel.y += step.y;
 			edge = pos.y < map.y ? NEG_Y : POS_Y;
 		}
 		else if (sideDist.z <= sideDist.x && sideDist.z <= sideDist.y && sideDist.z <= sideDist.w)
 		{
 			sideDist.z += deltaDist.z;
 			map.z += step.z;
+			texel.y += step.z * mapSize.y;
+			if (texel.y < 0 || texel.y >= mapZSlices * mapSize.y)
+				texel = GetMapTexel(map); //next group of z-slices
 			edge = pos.z < map.z ? NEG_Z : POS_Z;
 		}
 		else if (sideDist.w < sideDist.x && sideDist.w <= sideDist.y && sideDist.w <= sideDist.z)
 		{
 			sideDist.w += deltaDist.w;
 			map.w += step.w;
+			texel.z += step.w;
+			if (texel.z < 0 || texel.z >= MAP_TEXTURE_LAYERS)
+				texel = GetMapTexel(map); //next group of layers
 			edge = pos.w < map.w ? NEG_W : POS_W;
 		}
 
 		//check for hitPixel
 		if (!IsCubeIndexValid(map.x, map.y, map.z, map.w))
 		{
-			outRangeDistance = outRangeDistance + 1;
+			//the ray has left the map and never gets back: the side of the last cube, then the white outside
 			if (prevBlockType > 0)
-				hitPixel = GetPixelFromTexture(map, v, edge, step, prevBlockType);
-
-			if (outRangeDistance > outRangeMaxDistance)
+				hitPixel = GetPixelFromTexture(map, v, edge, step, prevBlockType, LIGHT_GRAD - 1);
+			else
 				hitPixel = vec4(1.0f, 1.0f, 1.0f, 1.0f); //alpha = 1.0f
 		}
 		else
 		{
-			ivec3 mapIdx = Convert4dIdxTo3dIdx(map);
-			cell = texelFetch(currentMap, mapIdx, 0);
-			lightLevel = GetLightLevelByIndex(edge, mapIdx);
-
-			blockType = int(cell.y * 255.0f);
-			//Check if ray has hit a wall
+			ivec3 mapIdx = texel;
+			cell = texelFetch(currentMap, mapIdx, 0).r;
+			if (cell == MAP_TEXEL_LIGHT)
+				blockType = 255; //light block type
+			else if (cell == MAP_TEXEL_REGULAR)
+				blockType = 10; //regular block type
+			else
+				distance = int(cell);
+
+			//Check if ray has hit a wall, light is only needed for the walls
 			if (blockType > 0)
+			{
+				lightLevel = GetLightLevelByIndex(edge, mapIdx);
 				hitPixel = GetPixelFromTexture(map, v, edge, step, blockType, lightLevel);
+			}
 			else if (prevBlockType > 0)
 				hitPixel = GetPixelFromTexture(map, v, edge, step, prevBlockType, prevLightLevel);
 		}
@@ -298,7 +462,27 @@ vec4 GetRaycastPixel(vec4 raycastVector)
 
 		CubePixel.w = 1 - (1 - Alpha)* (1 - hitPixel.w);
 		if (CubePixel.w >= 0.99f)
+		{
+			hitId = GetHitId(map, edge);
+			hitDist = sideDist[edge / 2] - deltaDist[edge / 2]; //the side is crossed by the last step
 			break;
+		}
+
+		//leap over the empty cubes around: every axis makes the steps,
+		//which DDA would make until the ray leaves them (same as Raycaster::FindPixel)
+		if (distance > 1)
+		{
+			vec4 exitDist = sideDist;
+			for (int i = 1; i < distance; i++)
+				exitDist += deltaDist;
+			int exitSide = 0;
+			for (int a = 1; a < 4; a++)
+				if (exitDist[a] < exitDist[exitSide])
+					exitSide = a;
+
+			SkipSteps(sideDist, map, deltaDist, step, exitDist[exitSide], exitSide);
+			texel = GetMapTexel(map);
+		}
 	}
 
 	return CubePixel;
@@ -341,48 +525,224 @@ vec2[9] GetOffsets(int multiplicator)
 	return offsets;
 }
 
-void main()
-{	
+//overlay user interface texture on top of game frame
+vec4 AddUserInterface(vec4 GamePixel, vec2 TexCoord)
+{
+	//the insets cover the user interface of the main view
+	if (view != 0)
+		return GamePixel;
 
+	vec4 UiPixel = texture(texture1, TexCoord);
+	float UiAlpha = texture(texture1, TexCoord).a;
 
-	if (CpuRender == 1)
+	return GamePixel * (1 - UiAlpha) + UiPixel*UiAlpha;
+}
+
+//history of the temporal anti-aliasing
+#ifdef COMPUTE_RAYCASTING
+ivec2 GetFrameSize() { return imageSize(frameImage); }
+vec4 LoadHistory(ivec2 pixel) { return imageLoad(historyImage, pixel); }
+uint LoadHistoryHit(ivec2 pixel) { return imageLoad(historyHitImage, pixel).r; }
+void StoreHistory(vec4 history) { imageStore(newHistoryImage, ivec2(gl_GlobalInvocationID.xy), history); }
+#else
+ivec2 GetFrameSize() { return textureSize(historyMap, 0); }
+vec4 LoadHistory(ivec2 pixel) { return texelFetch(historyMap, pixel, 0); }
+uint LoadHistoryHit(ivec2 pixel) { return texelFetch(historyHitMap, pixel, 0).r; }
+void StoreHistory(vec4 history) { FragHistory = history; }
+#endif
+
+//one jittered ray, blended with the history pixel, which has seen the same point of the same cube side:
+//the hit point goes to the screen of the history camera the way GetRaycastVector goes from the screen to the ray
+vec4 GetTemporalPixel(vec2 TexCoord, out uint hitId)
+{
+	ivec2 imageSizePx = GetFrameSize();
+
+	float hitDist;
+	vec4 v = GetRaycastVector(GetViewTexCoord(TexCoord + TemporalJitter / vec2(imageSizePx)));
+	vec4 samplePixel = GetRaycastPixel(v, hitId, hitDist);
+
+	float frames = 1.0f;
+	vec3 color = samplePixel.rgb;
+	if (TemporalHistory == 1)
 	{
-		FragColor = texture(texture1, TexCoord);
-		return;
+		//the rays, which miss the map, see the white outside in the same direction
+		vec4 d = hitDist < 0.0f ? v : pos + v * hitDist - historyPos[view];
+		vec4 p = vec4(dot(d, historyVx[view]), dot(d, historyVy[view]), dot(d, historyVz[view]), dot(d, historyVw[view]));
+		float Ratio = float(gameResolution.y) / gameResolution.x;
+		vec2 historyViewTexCoord = vec2(0.5f + p.z / (2 * p.x), 0.5f + p.y / (2 * Ratio * p.x));
+		vec2 historyTexCoord = viewRect[view].xy + historyViewTexCoord * viewRect[view].zw;
+
+		//bilinear filter of the 4 history pixels around, which have the same hit.
+		//The history pixels are taken for the pixel centers, so the jitter of this ray is taken back
+		vec2 historyPoint = historyTexCoord * vec2(imageSizePx) - 0.5f - TemporalJitter;
+		ivec2 historyPixel = ivec2(floor(historyPoint));
+		vec2 f = historyPoint - vec2(historyPixel);
+		vec4 history = vec4(0.0f, 0.0f, 0.0f, 0.0f);
+		float historyWeight = 0.0f;
+		//the point must have been seen by the same view
+		bool isVisible = p.x > 0.0f && (hitDist < 0.0f || abs(p.w) <= TEMPORAL_MAX_W_OFFSET) &&
+			all(greaterThanEqual(historyViewTexCoord, vec2(0.0f))) && all(lessThan(historyViewTexCoord, vec2(1.0f)));
+		for (int i = 0; i < 4 && isVisible; i++)
+		{
+			ivec2 offset = ivec2(i & 1, i >> 1);
+			ivec2 neighbour = historyPixel + offset;
+			if (any(lessThan(neighbour, ivec2(0))) || any(greaterThanEqual(neighbour, imageSizePx)) ||
+				LoadHistoryHit(neighbour) != hitId)
+				continue;
+			float weight = (offset.x == 1 ? f.x : 1.0f - f.x) * (offset.y == 1 ? f.y : 1.0f - f.y);
+			history += LoadHistory(neighbour) * weight;
+			historyWeight += weight;
+		}
+
+		if (historyWeight > 0.001f)
+		{
+			history /= historyWeight;
+			frames = min(history.a + 1.0f, TEMPORAL_MAX_FRAMES);
+			color = mix(history.rgb, samplePixel.rgb, 1.0f / frames);
+		}
 	}
 
+	StoreHistory(vec4(color, frames));
+	return vec4(color, samplePixel.a);
+}
+
+//pixel of the frame: the game with the user interface texture on top of it, or the CPU rendered frame.
+//The game pixel is the average of AliasMulitplicator^2 samples, hitId is the hit of the first one.
+vec4 GetFramePixel(vec2 TexCoord, int AliasMulitplicator, out uint hitId)
+{
+	hitId = HIT_CPU_FRAME;
+	if (CpuRender == 1)
+		return texture(texture1, TexCoord);
 
 	float pixelWidth = 1.0f / gameResolution.x;
 	if (CpuRender == 2 && TexCoord.x >= 0.5f - pixelWidth)
 	{
 		if (TexCoord.x <= 0.5f + pixelWidth)
-			FragColor = vec4(0.0f, 0.0f, 0.0f, 0.0f);
+			return vec4(0.0f, 0.0f, 0.0f, 0.0f);
 		else
-			FragColor = texture(texture1, TexCoord);
-		return;
+			return texture(texture1, TexCoord);
 	}
 
-	
-	//Anti-aliasing x1, x 4 or x9
-	int AliasMulitplicator = AntiAliasingEnabled + 1;
-	if (AliasMulitplicator > 3) AliasMulitplicator = 3;
-	if (AliasMulitplicator < 1) AliasMulitplicator = 1;
-	
+	SetView(FindView(TexCoord));
+
+	if (AntiAliasingPass == 3)
+		return AddUserInterface(GetTemporalPixel(TexCoord, hitId), TexCoord);
+
 	vec4 samplePixel[9];
 	vec2 offsets[9] = GetOffsets(AliasMulitplicator);
 	vec4 AntialiasedPixel = vec4(0.0f, 0.0f, 0.0f, 0.0f);
 	int maxSamples = AliasMulitplicator * AliasMulitplicator;
 	for (int i = 0; i < maxSamples; i++)
 	{
-		vec4 vSampleRay = GetRaycastVector(TexCoord + offsets[i]); //based on x,y screen position
-		samplePixel[i] = GetRaycastPixel(vSampleRay);
+		uint sampleHitId;
+		float sampleHitDist;
+		vec4 vSampleRay = GetRaycastVector(GetViewTexCoord(TexCoord + offsets[i])); //based on x,y screen position
+		samplePixel[i] = GetRaycastPixel(vSampleRay, sampleHitId, sampleHitDist);
 		AntialiasedPixel += samplePixel[i] / float(maxSamples);
+		if (i == 0)
+			hitId = sampleHitId;
 	}
 	vec4 GamePixel = AntialiasedPixel;
 
-	//overlay user interface texture on top of game frame
-	vec4 UiPixel = texture(texture1, TexCoord);
-	float UiAlpha = texture(texture1, TexCoord).a;
+	return AddUserInterface(GamePixel, TexCoord);
+}
+
+//Anti-aliasing x1, x 4 or x9
+int GetAliasMultiplicator()
+{
+	int AliasMulitplicator = AntiAliasingEnabled + 1;
+	if (AliasMulitplicator > 3) AliasMulitplicator = 3;
+	if (AliasMulitplicator < 1) AliasMulitplicator = 1;
+	return AliasMulitplicator;
+}
 
-	FragColor = GamePixel * (1 - UiAlpha) + UiPixel*UiAlpha;
-}
\ No newline at end of file
+//hit of the first pass of the adaptive anti-aliasing
+uint LoadHit(ivec2 pixel)
+{
+#ifdef COMPUTE_RAYCASTING
+	return imageLoad(hitImage, pixel).r;
+#else
+	return texelFetch(hitMap, pixel, 0).r;
+#endif
+}
+
+//the pixels with the same hit as all 4 neighbours keep the ray of the first pass
+bool IsInsideHit(ivec2 pixel, ivec2 imageSizePx, uint hitId)
+{
+	ivec2 maxPixel = imageSizePx - 1;
+	return LoadHit(min(pixel + ivec2(1, 0), maxPixel)) == hitId &&
+		LoadHit(max(pixel - ivec2(1, 0), ivec2(0))) == hitId &&
+		LoadHit(min(pixel + ivec2(0, 1), maxPixel)) == hitId &&
+		LoadHit(max(pixel - ivec2(0, 1), ivec2(0))) == hitId;
+}
+
+#ifdef COMPUTE_RAYCASTING
+void main()
+{
+	ivec2 imageSizePx = imageSize(frameImage);
+	ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+
+	//the rays of the tile differ only by the screen offset, the first invocation sets them up for all
+	//pixels of the view of the tile corner. The tiles on the borders of the insets trace the other view apart.
+	if (gl_LocalInvocationIndex == 0u)
+	{
+		float Ratio = float(gameResolution.y) / gameResolution.x;
+		vec2 cornerTexCoord = (vec2(gl_WorkGroupID.xy * gl_WorkGroupSize.xy) + 0.5f) / vec2(imageSizePx);
+		tileView = FindView(cornerTexCoord);
+		SetView(tileView);
+		tileTexCoord = GetViewTexCoord(cornerTexCoord);
+		tileRayDX = 2 * vz;
+		tileRayDY = 2 * vy * Ratio;
+		tileRay = vx + tileRayDX * (tileTexCoord.x - 0.5f) + tileRayDY * (tileTexCoord.y - 0.5f);
+	}
+	barrier();
+
+	//the tiles on the right and top borders are cut by the image
+	if (pixel.x >= imageSizePx.x || pixel.y >= imageSizePx.y)
+		return;
+
+	vec2 TexCoord = (vec2(pixel) + 0.5f) / vec2(imageSizePx);
+	uint hitId;
+	//the temporal anti-aliasing stores the hits for the next frame
+	if (AntiAliasingPass == 1 || AntiAliasingPass == 3)
+	{
+		imageStore(frameImage, pixel, GetFramePixel(TexCoord, 1, hitId));
+		imageStore(hitImage, pixel, uvec4(hitId));
+		return;
+	}
+
+	if (AntiAliasingPass == 2)
+	{
+		hitId = LoadHit(pixel);
+		if (IsInsideHit(pixel, imageSizePx, hitId))
+			return;
+	}
+
+	imageStore(frameImage, pixel, GetFramePixel(TexCoord, GetAliasMultiplicator(), hitId));
+}
+#else
+//the passes of the anti-aliasing render to the frame buffer, whose pixels are the pixels of the frame
+void main()
+{
+	uint hitId;
+	//the temporal anti-aliasing stores the hits for the next frame
+	if (AntiAliasingPass == 1 || AntiAliasingPass == 3)
+	{
+		FragColor = GetFramePixel(TexCoord, 1, hitId);
+		FragHitId = hitId;
+		return;
+	}
+
+	if (AntiAliasingPass == 2)
+	{
+		ivec2 pixel = ivec2(gl_FragCoord.xy);
+		hitId = LoadHit(pixel);
+		//the color of the first pass stays in the frame buffer
+		if (IsInsideHit(pixel, textureSize(hitMap, 0), hitId))
+			discard;
+	}
+
+	FragColor = GetFramePixel(TexCoord, GetAliasMultiplicator(), hitId);
+	FragHitId = hitId;
+}
+#endif
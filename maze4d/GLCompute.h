@@ -0,0 +1,47 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+// Compute shaders are core since GL 4.3, but glad is generated for GL 3.3,
+// so the few entry points and constants of the compute raycaster are loaded here
+#define GL_COMPUTE_SHADER 0x91B9
+#define GL_TEXTURE_FETCH_BARRIER_BIT 0x00000008
+#define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT 0x00000020
+
+class GLCompute
+{
+public:
+	static GLCompute* GetInstance()
+	{
+		static GLCompute instance;
+		return &instance;
+	}
+
+	// Loads the entry points from the current context, false if it is older than GL 4.3
+	bool Load()
+	{
+		isLoaded = false;
+		if (GLVersion.major < 4 || (GLVersion.major == 4 && GLVersion.minor < 3))
+			return false;
+
+		dispatchCompute = (DispatchComputeProc)glfwGetProcAddress("glDispatchCompute");
+		bindImageTexture = (BindImageTextureProc)glfwGetProcAddress("glBindImageTexture");
+		memoryBarrier = (MemoryBarrierProc)glfwGetProcAddress("glMemoryBarrier");
+		isLoaded = dispatchCompute != nullptr && bindImageTexture != nullptr && memoryBarrier != nullptr;
+		return isLoaded;
+	}
+
+	bool IsLoaded() const { return isLoaded; }
+
+	typedef void (APIENTRYP DispatchComputeProc)(GLuint numGroupsX, GLuint numGroupsY, GLuint numGroupsZ);
+	typedef void (APIENTRYP BindImageTextureProc)(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format);
+	typedef void (APIENTRYP MemoryBarrierProc)(GLbitfield barriers);
+
+	DispatchComputeProc dispatchCompute = nullptr;
+	BindImageTextureProc bindImageTexture = nullptr;
+	MemoryBarrierProc memoryBarrier = nullptr;
+
+private:
+	bool isLoaded = false;
+};
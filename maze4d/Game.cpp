@@ -17,8 +17,19 @@ void Game::Init()
 {
 	if (shaderGame == nullptr)
 	{
+		ProgramCache::GetInstance()->Load(cfg->GetBool("shader_cache"));
+		gpuRaycaster = cfg->GetInt("gpu_raycaster");
+		useComputeRaycaster = gpuRaycaster == 1 && GLCompute::GetInstance()->Load();
+		if (gpuRaycaster == 1 && !useComputeRaycaster)
+			Log("Compute shaders need OpenGL 4.3, the fragment shader raycaster is used");
+
 		shaderGame = new Shader();
-		shaderGame->LoadFromFiles("VertexShader.hlsl", "FragmentRaycasting4d.hlsl");
+		if (useComputeRaycaster)
+			shaderGame->LoadComputeFromFile("FragmentRaycasting4d.hlsl", "#define COMPUTE_RAYCASTING\n");
+		else
+			shaderGame->LoadFromFiles("VertexShader.hlsl", "FragmentRaycasting4d.hlsl");
+		ViewBuffer::BindShader(shaderGame);
+		ShaderSettings::BindShader(shaderGame);
 	}
 
 	if (shaderUi == nullptr)
@@ -28,20 +39,18 @@ void Game::Init()
 	}
 	
 
-	glUseProgram(shaderGame->ID);
-
-	GLint loc = glGetUniformLocation(shaderGame->ID, "gameResolution");
-	glUniform2i(loc, viewWidth, viewHeight);
+	ShaderSettings* settings = ShaderSettings::GetInstance();
+	settings->SetResolution(viewWidth, viewHeight);
 
 	int AntiAliasingEnabled = cfg->GetInt("anti_aliasing");
-	loc = glGetUniformLocation(shaderGame->ID, "AntiAliasingEnabled");
-	glUniform1i(loc, AntiAliasingEnabled);
+	settings->SetAntiAliasing(AntiAliasingEnabled);
+	adaptiveAntiAliasing = AntiAliasingEnabled > 0 && cfg->GetBool("adaptive_aa");
+	temporalAntiAliasing = cfg->GetBool("temporal_aa");
 
 	CpuRender = cfg->GetInt("cpu_render");
-	loc = glGetUniformLocation(shaderGame->ID, "CpuRender");
-	glUniform1i(loc, CpuRender);
+	settings->SetCpuRender(CpuRender);
 
-	Texture::TEX_SIZE = cfg->GetInt("cube_pixels");
+	Texture::TEX_SIZE = Cube::GetTexSize(cfg->GetInt("cube_pixels"));
 	Texture::BORDER_SIZE = cfg->GetInt("border_pixels");
 	Texture::TEX_SMOOTHERING_FLAG = cfg->GetBool("texture_smoothering");
 
@@ -52,8 +61,11 @@ void Game::Init()
 		glm::max(glm::abs(cfg->GetInt("maze_size_w")), 1));
 	int mazeRoomSize = glm::max(glm::abs(cfg->GetInt("maze_room_size")), 2);
 
-	Maze maze(mazeSize);
-	maze.Generate();
+	int mazeAlgorithm = cfg->GetInt("maze_algorithm");
+	int mazeThreads = cfg->GetInt("maze_threads");
+	int cellLayout = cfg->GetInt("cell_layout") == BRICK_LAYOUT_MORTON ? BRICK_LAYOUT_MORTON : BRICK_LAYOUT_TILED;
+	if (mazeThreads <= 0)
+		mazeThreads = glm::max((int)std::thread::hardware_concurrency(), 1);
 
 	field = new Field(glm::ivec4(
 		mazeSize.x * mazeRoomSize + 1, // +1 - map positive borders
@@ -61,9 +73,37 @@ void Game::Init()
 		mazeSize.z * mazeRoomSize + 1,
 		mazeSize.w * mazeRoomSize + 1),
 		glm::abs(cfg->GetInt("light_dist")),
-		mazeRoomSize);
+		mazeRoomSize,
+		cellLayout);
 
-	field->Init(&maze, shaderGame);
+	// Random seed gives a new world every time, so there is nothing to cache
+	WorldCache* worldCache = nullptr;
+	if (cfg->GetBool("world_cache") && cfg->GetInt("seed") != -1)
+	{
+		WorldKey key;
+		key.seed = cfg->GetInt("seed");
+		key.mazeSize = mazeSize;
+		key.roomSize = mazeRoomSize;
+		key.lightDist = glm::abs(cfg->GetInt("light_dist"));
+		key.mazeAlgorithm = mazeAlgorithm;
+		key.mazeThreads = mazeAlgorithm == MAZE_ALGORITHM_PARALLEL ? mazeThreads : 0;
+		key.cellLayout = cellLayout;
+		key.randomState = uint32_t(std::hash<std::string>()(Random::GetInstance()->GetState()));
+		worldCache = new WorldCache(key);
+	}
+
+	if (worldCache == nullptr || !field->Load(worldCache, shaderGame))
+	{
+		// Streamed maze is generated by Field::Init layer by layer
+		Maze maze(mazeSize);
+		if (mazeAlgorithm == MAZE_ALGORITHM_PARALLEL)
+			maze.GenerateParallel(mazeThreads);
+		else if (mazeAlgorithm != MAZE_ALGORITHM_STREAM)
+			maze.Generate();
+
+		field->Init(&maze, shaderGame, worldCache);
+	}
+	delete worldCache;
 
 	Cube::Init(shaderGame);
 
@@ -75,10 +115,12 @@ void Game::Init()
 
 	playerController = new PlayerController(cfg->GetFloat("speed"), cfg->GetFloat("mouse_sens"), &player);
 
-	mainScene = new GameGraphics(shaderGame, -1.0f, -1.0f, 2.0f, 2.0f);
+	// The raycasters render the scenes to images, which are drawn as plain textures, or are given to Draw
+	mainScene = new GameGraphics(shaderUi, -1.0f, -1.0f, 2.0f, 2.0f);
 	UserInterface = new GameGraphics(shaderUi, -1.0f, -1.0f, 2.0f, 2.0f);
-	helperScene1 = new GameGraphics(shaderGame, 0.6f, 0.55f, 0.35f, 0.35f);
-	helperScene2 = new GameGraphics(shaderGame, 0.6f, 0.15f, 0.35f, 0.35f);
+	views = new ViewBuffer();
+	dynamicResolution = NewDynamicResolution();
+	gpuProfiler = new GpuProfiler(cfg->GetBool("gpu_profile_csv") ? "gpu_profile.csv" : nullptr);
 
 
 }
@@ -94,11 +136,11 @@ void Game::ReinitVideoConfig()
 
 void Game::ApplyNewParameters()
 {
-	if (Texture::TEX_SIZE != cfg->GetInt("cube_pixels") ||
+	if (Texture::TEX_SIZE != Cube::GetTexSize(cfg->GetInt("cube_pixels")) ||
 		Texture::BORDER_SIZE != cfg->GetInt("border_pixels") ||
 		Texture::TEX_SMOOTHERING_FLAG != cfg->GetBool("texture_smoothering"))
 	{
-		Texture::TEX_SIZE = cfg->GetInt("cube_pixels");
+		Texture::TEX_SIZE = Cube::GetTexSize(cfg->GetInt("cube_pixels"));
 		Texture::BORDER_SIZE = cfg->GetInt("border_pixels");
 		Texture::TEX_SMOOTHERING_FLAG = cfg->GetBool("texture_smoothering");
 
@@ -128,16 +170,32 @@ void Game::ApplyNewParameters()
 	if (newViewHeight != viewHeight || newViewWidth != viewWidth)
 		NeedReconfigureResolution = true;
 
-	glUseProgram(shaderGame->ID);
+	// The compute raycaster may need another OpenGL version of the window
+	if (cfg->GetInt("gpu_raycaster") != gpuRaycaster)
+		NeedReconfigureResolution = true;
+
+	ShaderSettings* settings = ShaderSettings::GetInstance();
 
 	int AntiAliasingEnabled = cfg->GetInt("anti_aliasing");
-	GLuint loc = glGetUniformLocation(shaderGame->ID, "AntiAliasingEnabled");
-	glUniform1i(loc, AntiAliasingEnabled);
+	settings->SetAntiAliasing(AntiAliasingEnabled);
+	adaptiveAntiAliasing = AntiAliasingEnabled > 0 && cfg->GetBool("adaptive_aa");
+	temporalAntiAliasing = cfg->GetBool("temporal_aa");
 
 	CpuRender = cfg->GetInt("cpu_render");
-	loc = glGetUniformLocation(shaderGame->ID, "CpuRender");
-	glUniform1i(loc, CpuRender);
+	settings->SetCpuRender(CpuRender);
 
+	if (dynamicResolution != nullptr)
+		delete dynamicResolution;
+	dynamicResolution = NewDynamicResolution();
+}
+
+DynamicResolution* Game::NewDynamicResolution()
+{
+	// The CPU rendered frame has the fixed resolution
+	if (!cfg->GetBool("dynamic_resolution") || CpuRender == 1)
+		return nullptr;
+
+	return new DynamicResolution(cfg->GetFloat("target_frame_ms"), cfg->GetFloat("min_resolution_scale"), cfg->GetFloat("max_resolution_scale"));
 }
 
 void Game::NewGame()
@@ -148,60 +206,87 @@ void Game::NewGame()
 		delete field;
 	if (renderer != nullptr)
 		delete renderer;
+	DeleteScenes();
 
 	Init();	
 }
 
-void Game::UpdateShaderPlayer(Player curPlayer)
-{
-	glUseProgram(shaderGame->ID);
-
-	GLint loc = glGetUniformLocation(shaderGame->ID, "vx");
-	glUniform4f(loc, curPlayer.vx.x, curPlayer.vx.y, curPlayer.vx.z, curPlayer.vx.w);
-
-	loc = glGetUniformLocation(shaderGame->ID, "vy");
-	glUniform4f(loc, curPlayer.vy.x, curPlayer.vy.y, curPlayer.vy.z, curPlayer.vy.w);
-
-	loc = glGetUniformLocation(shaderGame->ID, "vz");
-	glUniform4f(loc, curPlayer.vz.x, curPlayer.vz.y, curPlayer.vz.z, curPlayer.vz.w);
-
-	loc = glGetUniformLocation(shaderGame->ID, "vw");
-	glUniform4f(loc, curPlayer.vw.x, curPlayer.vw.y, curPlayer.vw.z, curPlayer.vw.w);
-
-	loc = glGetUniformLocation(shaderGame->ID, "pos");
-	glUniform4f(loc, curPlayer.pos.x, curPlayer.pos.y, curPlayer.pos.z, curPlayer.pos.w);
-}
-
 void Game::Render(uint8_t* buffer)
 {
 	if (CpuRender > 0)
 		renderer->FillTexData(buffer, viewWidth, viewHeight);
 }
 
+void Game::DrawView(GameGraphics* scene)
+{
+	// The CPU rendered frame needs no raycaster
+	if (CpuRender == 1)
+		scene->Draw();
+	else if (useComputeRaycaster)
+	{
+		if (temporalAntiAliasing)
+			scene->RaycastTemporal(shaderGame);
+		else
+			scene->Raycast(shaderGame, adaptiveAntiAliasing);
+		scene->DrawRaycast();
+	}
+	// The fragment raycaster draws right to the screen, unless the anti-aliasing needs the images of its passes
+	else if (temporalAntiAliasing || adaptiveAntiAliasing)
+	{
+		if (temporalAntiAliasing)
+			scene->RaycastFragmentTemporal(shaderGame);
+		else
+			scene->RaycastFragment(shaderGame);
+		scene->DrawRaycast();
+	}
+	else
+		scene->Draw(shaderGame);
+}
+
 void Game::DrawScene(uint8_t* buffer)
 {
 	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
 	glClear(GL_COLOR_BUFFER_BIT);
 
-	UpdateShaderPlayer(player);
-	mainScene->Draw(buffer, viewWidth, viewHeight);
+	gpuProfiler->BeginFrame();
+
+	// The scenes go to the offscreen target, the user interface on top of it stays in the window resolution
+	bool isScaled = dynamicResolution != nullptr && dynamicResolution->Begin();
 
+	// The W rear views are insets of the main view, the raycaster traces all of them in one pass
+	views->Clear();
+	views->Add(player, -1.0f, -1.0f, 2.0f, 2.0f);
 	if (cfg->GetBool("show_w-rearviews"))
 	{
-		//create empty texture with 1 transparent pixel
-		uint8_t* emptyBuffer = new uint8_t[4];
-		memset(emptyBuffer, 0, 4);
-
 		Player wPlayer1 = player;
 		wPlayer1.RotateZW(90);
-		UpdateShaderPlayer(wPlayer1);
-		helperScene1->Draw(emptyBuffer, 1, 1);
+		views->Add(wPlayer1, 0.6f, 0.55f, 0.35f, 0.35f);
 
 		Player wPlayer2 = player;
 		wPlayer2.RotateYW(90);
-		UpdateShaderPlayer(wPlayer2);
-		helperScene2->Draw(emptyBuffer, 1, 1);
+		views->Add(wPlayer2, 0.6f, 0.15f, 0.35f, 0.35f);
 	}
+	views->Upload();
+
+	gpuProfiler->Begin(GPU_PASS_UPLOAD);
+	mainScene->Upload(buffer, viewWidth, viewHeight);
+	gpuProfiler->End(GPU_PASS_UPLOAD);
+
+	gpuProfiler->Begin(GPU_PASS_RAYCAST);
+	DrawView(mainScene);
+	gpuProfiler->End(GPU_PASS_RAYCAST);
+
+	if (isScaled)
+	{
+		gpuProfiler->Begin(GPU_PASS_UPSCALE);
+		dynamicResolution->End(UserInterface);
+		gpuProfiler->End(GPU_PASS_UPSCALE);
+	}
+
+	// The same frame, it is uploaded once
+	gpuProfiler->Begin(GPU_PASS_UI);
+	UserInterface->Draw(mainScene);
+	gpuProfiler->End(GPU_PASS_UI);
 
-	UserInterface->Draw(buffer, viewWidth, viewHeight);
+	gpuProfiler->EndFrame();
 }
\ No newline at end of file
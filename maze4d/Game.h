@@ -1,6 +1,9 @@
 #pragma once
 
 #include <GameGraphics.h>
+#include <DynamicResolution.h>
+#include <ViewBuffer.h>
+#include <GpuProfiler.h>
 #include <Field.h>
 
 #include <Player.h>
@@ -28,12 +31,7 @@ public:
 			delete cfg;
 		if (renderer != nullptr)
 			delete renderer;
-		if (mainScene != nullptr)
-			delete mainScene;
-		if (helperScene1 != nullptr)
-			delete helperScene1;
-		if (helperScene2 != nullptr)
-			delete helperScene2;
+		DeleteScenes();
 		if (shaderGame != nullptr)
 			delete shaderGame;
 		if (shaderUi != nullptr)
@@ -45,6 +43,7 @@ public:
 	void DrawScene(uint8_t* buffer);
 	void ReinitVideoConfig();
 	bool NeedReconfigureResolution = false;
+	// Before the window is destroyed: the next window has a new context
 	void ClearShaders()
 	{
 		if (shaderGame != nullptr)
@@ -53,12 +52,16 @@ public:
 			delete shaderUi;
 		shaderGame = nullptr;
 		shaderUi = nullptr;
+		ShaderSettings::GetInstance()->Reset();
 	}
 	
 
 	void NewGame();
 	void ApplyNewParameters();
 
+	// GPU time of the passes of the frame, nullptr before Init
+	const GpuProfiler* GetGpuProfiler() const { return gpuProfiler; }
+
 	int viewWidth;
 	int viewHeight;
 	float viewScale;
@@ -77,9 +80,39 @@ private:
 	Renderer* renderer = nullptr;
 	GameGraphics* mainScene = nullptr;
 	GameGraphics* UserInterface = nullptr;
-	GameGraphics* helperScene1 = nullptr;
-	GameGraphics* helperScene2 = nullptr;
+	// Cameras of the main view and the W rear views over it
+	ViewBuffer* views = nullptr;
 	Shader* shaderGame = nullptr;
 	Shader* shaderUi = nullptr;
-	void UpdateShaderPlayer(Player curPlayer);
+	// Config value and whether the compute raycaster is used: shaderGame is then a compute shader
+	int gpuRaycaster = 0;
+	bool useComputeRaycaster = false;
+	bool adaptiveAntiAliasing = false;
+	bool temporalAntiAliasing = false;
+	// Offscreen target of the scenes with the scaled resolution, nullptr if the resolution is fixed
+	DynamicResolution* dynamicResolution = nullptr;
+	DynamicResolution* NewDynamicResolution();
+	GpuProfiler* gpuProfiler = nullptr;
+	// Draws the uploaded views to the scene with the uploaded frame
+	void DrawView(GameGraphics* scene);
+public:
+	// Before a new game and before the window is destroyed: the GL objects belong to its context
+	void DeleteScenes()
+	{
+		if (mainScene != nullptr)
+			delete mainScene;
+		if (UserInterface != nullptr)
+			delete UserInterface;
+		if (views != nullptr)
+			delete views;
+		if (gpuProfiler != nullptr)
+			delete gpuProfiler;
+		if (dynamicResolution != nullptr)
+			delete dynamicResolution;
+		mainScene = nullptr;
+		UserInterface = nullptr;
+		views = nullptr;
+		gpuProfiler = nullptr;
+		dynamicResolution = nullptr;
+	}
 };
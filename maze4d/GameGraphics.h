@@ -3,6 +3,23 @@
 #include <glad/glad.h>
 #include <shader.h>
 #include <Player.h>
+#include <GLCompute.h>
+
+#include <cstring>
+
+// Frames go to the texture through a ring of pixel buffers: glTexSubImage2D from a buffer returns
+// at once and the copy to the texture runs while the next frames are rendered.
+// A buffer is written again after FRAME_PIXEL_BUFFERS uploads, when its copy is surely finished.
+#define FRAME_PIXEL_BUFFERS 3
+
+// Jitter positions of the temporal anti-aliasing, the sequence is repeated after them
+#define TEMPORAL_JITTER_FRAMES 16
+
+// Texture units of the images, which the fragment raycaster samples: the hits of the first pass
+// of the adaptive anti-aliasing, the history and its hits of the temporal anti-aliasing
+#define HIT_TEXTURE_UNIT 3
+#define HISTORY_TEXTURE_UNIT 4
+#define HISTORY_HIT_TEXTURE_UNIT 5
 
 class GameGraphics
 {
@@ -14,8 +31,40 @@ public:
 		InitScene(bottomX, bottomY, width, height);
 	}
 
+	~GameGraphics()
+	{
+		// The scene may outlive the GL context (e.g. on exit)
+		if (glfwGetCurrentContext() == nullptr)
+			return;
+
+		for (int b = 0; b < FRAME_PIXEL_BUFFERS; b++)
+			if (uploadFences[b] != nullptr)
+				glDeleteSync(uploadFences[b]);
+		glDeleteBuffers(FRAME_PIXEL_BUFFERS, pixelBuffers);
+		glDeleteTextures(1, &screenTex);
+		if (raycastFramebuffer != 0)
+			glDeleteFramebuffers(1, &raycastFramebuffer);
+		if (raycastTex != 0)
+			glDeleteTextures(1, &raycastTex);
+		for (int i = 0; i < 2; i++)
+		{
+			if (hitTex[i] != 0)
+				glDeleteTextures(1, &hitTex[i]);
+			if (historyTex[i] != 0)
+				glDeleteTextures(1, &historyTex[i]);
+		}
+		glDeleteBuffers(1, &VBO);
+		glDeleteBuffers(1, &EBO);
+		glDeleteVertexArrays(1, &VAO);
+	}
+
 	void InitScene(float bottomX, float bottomY, float width, float height)
 	{
+		sceneX = bottomX;
+		sceneY = bottomY;
+		sceneWidth = width;
+		sceneHeight = height;
+
 		glEnable(GL_BLEND);
 		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
@@ -32,7 +81,6 @@ public:
 			0, 1, 3, // first triangle
 			1, 2, 3  // second triangle
 		};
-		unsigned int VBO, EBO;
 		glGenVertexArrays(1, &VAO);
 		glGenBuffers(1, &VBO);
 		glGenBuffers(1, &EBO);
@@ -65,23 +113,375 @@ public:
 		// set texture filtering parameters
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		glGenBuffers(FRAME_PIXEL_BUFFERS, pixelBuffers);
+	}
+
+	void Upload(const uint8_t* CpuTexData, int viewWidth, int viewHeight)
+	{
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, screenTex);
+
+		GLsizeiptr bytes = GLsizeiptr(viewWidth) * viewHeight * 4;
+		if (viewWidth != texWidth || viewHeight != texHeight)
+		{
+			// The storage is only reallocated when the resolution changes
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, viewWidth, viewHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			texWidth = viewWidth;
+			texHeight = viewHeight;
+
+			for (int b = 0; b < FRAME_PIXEL_BUFFERS; b++)
+			{
+				WaitUpload(b);
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffers[b]);
+				glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+			}
+		}
+
+		int b = nextPixelBuffer;
+		nextPixelBuffer = (nextPixelBuffer + 1) % FRAME_PIXEL_BUFFERS;
+		WaitUpload(b);
+
+		// Unsynchronized: the fence has already told that the GL doesn't read the buffer
+		bool isUploaded = false;
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffers[b]);
+		void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		if (mapped != nullptr)
+		{
+			memcpy(mapped, CpuTexData, bytes);
+			// False if the buffer contents are lost, e.g. on a video mode switch
+			isUploaded = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE;
+		}
+		if (isUploaded)
+		{
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, viewWidth, viewHeight, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+			uploadFences[b] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		if (!isUploaded)
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, viewWidth, viewHeight, GL_RGBA, GL_UNSIGNED_BYTE, CpuTexData);
+	}
+
+	void Draw()
+	{
+		Draw(this);
+	}
+
+	// Draws the frame uploaded to the other scene, e.g. the same CPU frame with another shader
+	void Draw(const GameGraphics* frameScene)
+	{
+		Draw(frameScene->screenTex);
+	}
+
+	void Draw(GLuint texture)
+	{
+		Draw(shader, texture);
+	}
+
+	// Draws the uploaded frame with another shader, e.g. the fragment raycaster
+	void Draw(Shader* frameShader)
+	{
+		Draw(frameShader, screenTex);
 	}
 
 	void Draw(uint8_t* CpuTexData, int viewWidth, int viewHeight)
+	{
+		Upload(CpuTexData, viewWidth, viewHeight);
+		Draw();
+	}
+
+	// Renders the scene with the compute raycaster (FragmentRaycasting4d.hlsl as a compute shader)
+	// to the image of the size of the scene on the screen, one workgroup per 8x8 pixels.
+	// The uploaded frame is its texture1 as for the fragment raycaster.
+	// Adaptive anti-aliasing traces one ray per pixel first, then all the samples only for the pixels
+	// on the edges: whose hit cube side differs from a neighbour's.
+	void Raycast(Shader* raycaster, bool adaptiveAntiAliasing = false)
+	{
+		int width, height;
+		ResizeRaycast(adaptiveAntiAliasing ? 1 : 0, 0, width, height);
+
+		GLCompute* gl = GLCompute::GetInstance();
+		raycaster->use();
+		gl->bindImageTexture(0, raycastTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+		if (adaptiveAntiAliasing)
+		{
+			gl->bindImageTexture(1, hitTex[0], 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+			raycaster->setInt(UNIFORM_ANTI_ALIASING_PASS, 1);
+			gl->dispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+			// the second pass reads the hits of the neighbours
+			gl->memoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+			raycaster->setInt(UNIFORM_ANTI_ALIASING_PASS, 2);
+		}
+		else
+			raycaster->setInt(UNIFORM_ANTI_ALIASING_PASS, 0);
+		gl->dispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+		// the image is read as a texture by DrawRaycast
+		gl->memoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	}
+
+	// Renders the scene with the fragment raycaster to the image of the compute raycaster in the two passes
+	// of the adaptive anti-aliasing: the first one writes the color and the hit of one ray per pixel to the frame buffer
+	// with two attachments, the second one samples the hits and traces all the samples only for the pixels on the edges.
+	// The other pixels are discarded and keep the color of the first pass.
+	void RaycastFragment(Shader* raycaster)
+	{
+		int width, height;
+		ResizeRaycast(1, 0, width, height);
+		BeginRaycastFragment(width, height, hitTex[0], 0);
+
+		raycaster->use();
+		raycaster->setInt(UNIFORM_HIT_MAP, HIT_TEXTURE_UNIT);
+		raycaster->setInt(UNIFORM_ANTI_ALIASING_PASS, 1);
+		Draw(raycaster, screenTex);
+
+		// The hits are sampled by the second pass, so they are no longer the attachment
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, 0, 0);
+		glDrawBuffers(1, raycastDrawBuffers);
+		glActiveTexture(GL_TEXTURE0 + HIT_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_2D, hitTex[0]);
+		raycaster->setInt(UNIFORM_ANTI_ALIASING_PASS, 2);
+		Draw(raycaster, screenTex);
+		raycaster->setInt(UNIFORM_ANTI_ALIASING_PASS, 0);
+		glActiveTexture(GL_TEXTURE0 + HIT_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		EndRaycastFragment();
+	}
+
+	// Temporal anti-aliasing: one ray per pixel, which is moved inside the pixel every frame,
+	// blended with the history of the previous frames of this scene. The history pixel is found
+	// by the hit point of the ray in the camera of the previous frame and is dropped,
+	// if another cube side was hit there. The cameras of both frames are in the ViewBuffer.
+	void RaycastTemporal(Shader* raycaster)
+	{
+		int width, height;
+		int history, current;
+		BeginTemporal(raycaster, width, height, history, current);
+
+		GLCompute* gl = GLCompute::GetInstance();
+		gl->bindImageTexture(0, raycastTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+		gl->bindImageTexture(1, hitTex[current], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32UI);
+		gl->bindImageTexture(2, historyTex[history], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA16F);
+		gl->bindImageTexture(3, historyTex[current], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+		gl->bindImageTexture(4, hitTex[history], 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32UI);
+		gl->dispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+		// the image is read as a texture by DrawRaycast, the history by the next frame
+		gl->memoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+
+	// Temporal anti-aliasing of RaycastTemporal with the fragment raycaster: the history and the hits
+	// of the previous frame are sampled, the ones of this frame are the next attachments of the frame buffer
+	void RaycastFragmentTemporal(Shader* raycaster)
+	{
+		int width, height;
+		int history, current;
+		BeginTemporal(raycaster, width, height, history, current);
+		BeginRaycastFragment(width, height, hitTex[current], historyTex[current]);
+
+		raycaster->setInt(UNIFORM_HISTORY_MAP, HISTORY_TEXTURE_UNIT);
+		raycaster->setInt(UNIFORM_HISTORY_HIT_MAP, HISTORY_HIT_TEXTURE_UNIT);
+		glActiveTexture(GL_TEXTURE0 + HISTORY_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_2D, historyTex[history]);
+		glActiveTexture(GL_TEXTURE0 + HISTORY_HIT_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_2D, hitTex[history]);
+		Draw(raycaster, screenTex);
+
+		// They are the attachments of the next frame
+		glActiveTexture(GL_TEXTURE0 + HISTORY_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glActiveTexture(GL_TEXTURE0 + HISTORY_HIT_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		EndRaycastFragment();
+	}
+
+	// Draws the image of the last Raycast or RaycastFragment
+	void DrawRaycast()
+	{
+		Draw(raycastTex);
+	}
+
+private:
+	void Draw(Shader* quadShader, GLuint texture)
 	{
 		// bind textures on corresponding texture units
 		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, screenTex);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, viewWidth, viewHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, CpuTexData);
+		glBindTexture(GL_TEXTURE_2D, texture);
 
-		shader->use();
+		quadShader->use();
 		glBindVertexArray(VAO);
 		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 	}
 
-private:
+	// Sets up the frame of the temporal anti-aliasing: the images, the jitter and which of the ping-pong images
+	// have the history; the next frame swaps them
+	void BeginTemporal(Shader* raycaster, int& width, int& height, int& history, int& current)
+	{
+		ResizeRaycast(2, 2, width, height);
+
+		history = historyFrame % 2;
+		current = 1 - history;
+		int jitterIndex = historyFrame % TEMPORAL_JITTER_FRAMES + 1;
+
+		raycaster->use();
+		raycaster->setInt(UNIFORM_ANTI_ALIASING_PASS, 3);
+		raycaster->setInt(UNIFORM_TEMPORAL_HISTORY, historyFrame > 0 ? 1 : 0);
+		raycaster->setVec2(UNIFORM_TEMPORAL_JITTER, Halton(jitterIndex, 2) - 0.5f, Halton(jitterIndex, 3) - 0.5f);
+
+		historyFrame++;
+	}
+
+	// Binds the frame buffer of the fragment raycaster: the image, the hits and the history (if not 0) are its attachments.
+	// The window frame buffer and the viewport are restored by EndRaycastFragment.
+	void BeginRaycastFragment(int width, int height, GLuint hitTexture, GLuint historyTexture)
+	{
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &windowFramebuffer);
+		glGetIntegerv(GL_VIEWPORT, windowViewport);
+
+		if (raycastFramebuffer == 0)
+			glGenFramebuffers(1, &raycastFramebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, raycastFramebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, raycastTex, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, hitTexture, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, historyTexture, 0);
+		glDrawBuffers(historyTexture != 0 ? 3 : 2, raycastDrawBuffers);
+
+		// The quad of the scene covers the image: the pixels of the frame buffer are the pixels of the image
+		glViewport(int(glm::round(-(sceneX + 1.0f) * width / sceneWidth)), int(glm::round(-(sceneY + 1.0f) * height / sceneHeight)),
+			int(glm::round(2.0f * width / sceneWidth)), int(glm::round(2.0f * height / sceneHeight)));
+		// The image has the colors of the raycaster, they are blended when it is drawn
+		glDisable(GL_BLEND);
+	}
+
+	void EndRaycastFragment()
+	{
+		glEnable(GL_BLEND);
+		glBindFramebuffer(GL_FRAMEBUFFER, windowFramebuffer);
+		glViewport(windowViewport[0], windowViewport[1], windowViewport[2], windowViewport[3]);
+	}
+
+	// Sizes the images of the raycasters by the scene on the screen. The hit and the history
+	// images are created on the first use, the history is dropped with a new size.
+	void ResizeRaycast(int hitImages, int historyImages, int& width, int& height)
+	{
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		width = glm::max(int(viewport[2] * sceneWidth / 2.0f + 0.5f), 1);
+		height = glm::max(int(viewport[3] * sceneHeight / 2.0f + 0.5f), 1);
+
+		glActiveTexture(GL_TEXTURE0);
+		if (raycastTex == 0)
+			raycastTex = CreateImageTexture();
+		for (int i = 0; i < hitImages; i++)
+			if (hitTex[i] == 0)
+			{
+				hitTex[i] = CreateImageTexture();
+				raycastWidth = 0;
+			}
+		for (int i = 0; i < historyImages; i++)
+			if (historyTex[i] == 0)
+			{
+				historyTex[i] = CreateImageTexture();
+				raycastWidth = 0;
+			}
+
+		if (width != raycastWidth || height != raycastHeight)
+		{
+			glBindTexture(GL_TEXTURE_2D, raycastTex);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			for (int i = 0; i < 2; i++)
+			{
+				if (hitTex[i] != 0)
+				{
+					glBindTexture(GL_TEXTURE_2D, hitTex[i]);
+					glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, width, height, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+				}
+				if (historyTex[i] != 0)
+				{
+					glBindTexture(GL_TEXTURE_2D, historyTex[i]);
+					glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+				}
+			}
+			raycastWidth = width;
+			raycastHeight = height;
+			historyFrame = 0;
+		}
+
+		glBindTexture(GL_TEXTURE_2D, screenTex);
+	}
+
+	// The images cover the scene pixel to pixel
+	static GLuint CreateImageTexture()
+	{
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		return texture;
+	}
+
+	// Low-discrepancy sequence 0...1 for the jitter of the temporal anti-aliasing
+	static float Halton(int index, int base)
+	{
+		float result = 0.0f;
+		float fraction = 1.0f;
+		while (index > 0)
+		{
+			fraction /= base;
+			result += fraction * (index % base);
+			index /= base;
+		}
+		return result;
+	}
+
+	// Waits until the GL has copied the buffer to the texture
+	void WaitUpload(const int b)
+	{
+		if (uploadFences[b] == nullptr)
+			return;
+
+		while (glClientWaitSync(uploadFences[b], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+		glDeleteSync(uploadFences[b]);
+		uploadFences[b] = nullptr;
+	}
+
 	unsigned int screenTex;
 	unsigned int VAO;
+	unsigned int VBO;
+	unsigned int EBO;
+	int texWidth = 0;
+	int texHeight = 0;
+	// Corner and size of the quad in the -1.0f...1.0f viewport
+	float sceneX;
+	float sceneY;
+	float sceneWidth;
+	float sceneHeight;
+
+	// Image of the compute raycaster or of the passes of the fragment raycaster, which render to raycastFramebuffer
+	GLuint raycastTex = 0;
+	GLuint raycastFramebuffer = 0;
+	GLenum raycastDrawBuffers[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+	// Frame buffer and viewport, which the passes of the fragment raycaster return to
+	GLint windowFramebuffer = 0;
+	GLint windowViewport[4] = {};
+	int raycastWidth = 0;
+	int raycastHeight = 0;
+	// Hits of the first pass of the adaptive anti-aliasing (the first one),
+	// the hits of the current and the previous frame of the temporal anti-aliasing
+	GLuint hitTex[2] = {};
+	// Colors blended over the previous frames and their number (alpha) of the temporal anti-aliasing
+	GLuint historyTex[2] = {};
+	// Frames in the history
+	int historyFrame = 0;
+
+	GLuint pixelBuffers[FRAME_PIXEL_BUFFERS];
+	GLsync uploadFences[FRAME_PIXEL_BUFFERS] = {};
+	int nextPixelBuffer = 0;
 	Shader* shader = nullptr;
 
 };
\ No newline at end of file
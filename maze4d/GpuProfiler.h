@@ -0,0 +1,206 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <Utils.h>
+
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+// The timestamps are read FRAME_TIMESTAMP_QUERIES frames later, when they have surely arrived,
+// so the measurement never waits for the GPU
+#define FRAME_TIMESTAMP_QUERIES 4
+// Statistics of a pass are taken over its last measurements
+#define GPU_PASS_SAMPLES 120
+
+// Passes of the frame, see Game::DrawScene. The W rear views are traced in the raycast pass
+enum GPU_PASS
+{
+	GPU_PASS_UPLOAD = 0, // CPU frame (the user interface) to the texture
+	GPU_PASS_RAYCAST,    // all the views of the scene
+	GPU_PASS_UPSCALE,    // the dynamic resolution target to the window
+	GPU_PASS_UI,         // the user interface over the scene
+	GPU_PASS_COUNT
+};
+
+struct GpuPassStats
+{
+	float averageMs = 0.0f;
+	float p95Ms = 0.0f;
+	float maxMs = 0.0f;
+	int samples = 0;
+};
+
+// GPU time of every pass of the frame. A pass is put between two GL_TIMESTAMP queries: they don't nest like
+// GL_TIME_ELAPSED ones, so the passes may be inside the frame time query of DynamicResolution.
+// Each second the statistics may be appended to a CSV file.
+class GpuProfiler
+{
+public:
+	GpuProfiler(const char* csvFileName = nullptr)
+	{
+		GLint bits = 0;
+		glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &bits);
+		isEnabled = bits > 0;
+		if (!isEnabled)
+		{
+			Log("GPU timestamps are not supported, the passes are not measured");
+			return;
+		}
+
+		glGenQueries(FRAME_TIMESTAMP_QUERIES * GPU_PASS_COUNT * 2, &queries[0][0][0]);
+		for (int p = 0; p < GPU_PASS_COUNT; p++)
+			samples[p].reserve(GPU_PASS_SAMPLES);
+
+		// The profiler is created again for a new game and a new window, their measurements are appended.
+		// The seconds start from 1 again for each of them
+		if (csvFileName != nullptr)
+		{
+			bool isEmpty = std::ifstream(csvFileName, std::ios::binary | std::ios::ate).tellg() <= 0;
+			csvFile.open(csvFileName, std::ios::app);
+			if (!csvFile.is_open())
+				Log("Unable to write GPU profile ", csvFileName);
+			else
+			{
+				if (isEmpty)
+				{
+					csvFile << "seconds";
+					for (int p = 0; p < GPU_PASS_COUNT; p++)
+						csvFile << "," << GetPassName(p) << "_avg_ms," << GetPassName(p) << "_p95_ms," << GetPassName(p) << "_max_ms";
+					csvFile << "\n";
+				}
+				csvTime = glfwGetTime();
+			}
+		}
+	}
+
+	~GpuProfiler()
+	{
+		// The queries may outlive the GL context (e.g. on exit)
+		if (isEnabled && glfwGetCurrentContext() != nullptr)
+			glDeleteQueries(FRAME_TIMESTAMP_QUERIES * GPU_PASS_COUNT * 2, &queries[0][0][0]);
+	}
+
+	// Collects the passes of the frame, whose queries are used again by this one
+	void BeginFrame()
+	{
+		if (!isEnabled)
+			return;
+
+		int slot = frame % FRAME_TIMESTAMP_QUERIES;
+		for (int p = 0; p < GPU_PASS_COUNT; p++)
+		{
+			if (!isMeasured[slot][p])
+				continue;
+			isMeasured[slot][p] = false;
+
+			GLint isAvailable = 0;
+			glGetQueryObjectiv(queries[slot][p][1], GL_QUERY_RESULT_AVAILABLE, &isAvailable);
+			if (!isAvailable)
+				continue;
+
+			GLuint64 begin = 0, end = 0;
+			glGetQueryObjectui64v(queries[slot][p][0], GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(queries[slot][p][1], GL_QUERY_RESULT, &end);
+			AddSample(p, end > begin ? float((end - begin) / 1000000.0) : 0.0f);
+		}
+	}
+
+	void Begin(int pass)
+	{
+		if (isEnabled)
+			glQueryCounter(queries[frame % FRAME_TIMESTAMP_QUERIES][pass][0], GL_TIMESTAMP);
+	}
+
+	void End(int pass)
+	{
+		if (!isEnabled)
+			return;
+
+		int slot = frame % FRAME_TIMESTAMP_QUERIES;
+		glQueryCounter(queries[slot][pass][1], GL_TIMESTAMP);
+		isMeasured[slot][pass] = true;
+	}
+
+	void EndFrame()
+	{
+		if (!isEnabled)
+			return;
+
+		frame++;
+		if (csvFile.is_open() && glfwGetTime() - csvTime >= 1.0)
+		{
+			csvTime += 1.0;
+			csvSeconds++;
+			WriteCsv();
+		}
+	}
+
+	// Statistics of the last GPU_PASS_SAMPLES measurements, empty if the pass was not run
+	GpuPassStats GetStats(int pass) const
+	{
+		GpuPassStats stats;
+		const std::vector<float>& passSamples = samples[pass];
+		stats.samples = int(passSamples.size());
+		if (stats.samples == 0)
+			return stats;
+
+		std::vector<float> sorted(passSamples);
+		int p95 = glm::clamp(int(glm::ceil(0.95f * stats.samples)) - 1, 0, stats.samples - 1);
+		std::nth_element(sorted.begin(), sorted.begin() + p95, sorted.end());
+		stats.p95Ms = sorted[p95];
+		for (float ms : passSamples)
+		{
+			stats.averageMs += ms;
+			stats.maxMs = glm::max(stats.maxMs, ms);
+		}
+		stats.averageMs /= stats.samples;
+		return stats;
+	}
+
+	static const char* GetPassName(int pass)
+	{
+		static const char* names[GPU_PASS_COUNT] = { "upload", "raycast", "upscale", "ui" };
+		return names[pass];
+	}
+
+	bool IsEnabled() const { return isEnabled; }
+
+private:
+	void AddSample(int pass, float ms)
+	{
+		std::vector<float>& passSamples = samples[pass];
+		if (int(passSamples.size()) < GPU_PASS_SAMPLES)
+			passSamples.push_back(ms);
+		else
+			passSamples[nextSample[pass]] = ms;
+		nextSample[pass] = (nextSample[pass] + 1) % GPU_PASS_SAMPLES;
+	}
+
+	void WriteCsv()
+	{
+		csvFile << csvSeconds;
+		for (int p = 0; p < GPU_PASS_COUNT; p++)
+		{
+			GpuPassStats stats = GetStats(p);
+			csvFile << "," << stats.averageMs << "," << stats.p95Ms << "," << stats.maxMs;
+		}
+		csvFile << "\n";
+		csvFile.flush();
+	}
+
+	bool isEnabled = false;
+	// Begin and end timestamps of the passes of the last frames
+	GLuint queries[FRAME_TIMESTAMP_QUERIES][GPU_PASS_COUNT][2];
+	bool isMeasured[FRAME_TIMESTAMP_QUERIES][GPU_PASS_COUNT] = {};
+	int frame = 0;
+
+	// Ring of the last measurements of the passes, in milliseconds
+	std::vector<float> samples[GPU_PASS_COUNT];
+	int nextSample[GPU_PASS_COUNT] = {};
+
+	std::ofstream csvFile;
+	double csvTime = 0.0;
+	int csvSeconds = 0;
+};
@@ -176,6 +176,23 @@ void MainUiController::RenderPlayerinfo(Player* player, uint8_t* buffer)
 	RenderUItext(anglesText, fontSize, buffer, paddingX, maxHeight - paddingY);
 	paddingY += lineSpace;
 
+	//Render GPU time of the passes, which were run
+	const GpuProfiler* profiler = game->GetGpuProfiler();
+	for (int pass = 0; profiler != nullptr && pass < GPU_PASS_COUNT; pass++)
+	{
+		GpuPassStats stats = profiler->GetStats(pass);
+		if (stats.samples == 0)
+			continue;
+
+		stream.str(std::string()); //empty string
+		stream << "GPU " << GpuProfiler::GetPassName(pass) << " ms avg:" << float2str(stats.averageMs, 2, floatLength);
+		stream << " p95:" << float2str(stats.p95Ms, 2, floatLength);
+		stream << " max:" << float2str(stats.maxMs, 2, floatLength);
+
+		RenderUItext(stream.str(), fontSize, buffer, paddingX, maxHeight - paddingY);
+		paddingY += lineSpace;
+	}
+
 
 	//there is no mistake - it is assignment, not comparison
 	//Turn to "true" while debugging
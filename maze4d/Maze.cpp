@@ -2,134 +2,307 @@
 
 Maze::Maze(const glm::ivec4 size) : size(size)
 {
-	rooms = new Room[size.x*size.y*size.z*size.w];
+	strides[NEG_X] = -size.y*size.z*size.w; strides[POS_X] = size.y*size.z*size.w;
+	strides[NEG_Y] = -size.z*size.w;        strides[POS_Y] = size.z*size.w;
+	strides[NEG_Z] = -size.w;               strides[POS_Z] = size.w;
+	strides[NEG_W] = -1;                    strides[POS_W] = 1;
 }
 
 Maze::~Maze()
 {
-	delete[] rooms;
+	delete[] walls;
 }
 
 bool Maze::IsWallExist(int edge, glm::ivec4 pos)
 {
 	assert(IsRoomIndexValid(pos.x, pos.y, pos.z, pos.w));
-	return rooms[GetIndex(pos.x, pos.y, pos.z, pos.w)].walls[edge];
+	int axis = edge / 2;
+	assert(pos.x < generatedSlabs && pos.x >= generatedSlabs - storedSlabs);
+	int index = GetIndex(pos.x, pos.y, pos.z, pos.w);
+
+	if (edge % 2 == 0)
+	{
+		// Negative maze border is always closed
+		if (pos[axis] == 0)
+			return true;
+		index += strides[edge];
+	}
+
+	// Streamed layers are stored in a ring, the whole maze is not
+	if (storedSlabs < size.x)
+		index %= storedRooms;
+
+	return ((walls[index >> 1] >> ((index & 1) * 4 + axis)) & 1) != 0;
+}
+
+void Maze::RemoveWall(const int index, const int edge)
+{
+	int wallIndex = (edge % 2 == 0) ? index + strides[edge] : index;
+	walls[wallIndex >> 1] &= ~(1 << ((wallIndex & 1) * 4 + edge / 2));
+}
+
+void Maze::AllocateWalls(const int slabs)
+{
+	delete[] walls;
+	storedSlabs = slabs;
+	storedRooms = slabs*size.y*size.z*size.w;
+	walls = new uint8_t[(storedRooms + 1) / 2];
 }
 
 void Maze::Generate()
 {
 	// Filling the maze with walls
-	for (int x = 0; x < size.x; x++)
+	AllocateWalls(size.x);
+	memset(walls, 0xFF, (storedRooms + 1) / 2);
+
+	CarveBlock(0, size.x, Random::GetInstance());
+	generatedSlabs = size.x;
+}
+
+void Maze::GenerateParallel(int threads)
+{
+	if (threads <= 0)
+		threads = glm::max((int)std::thread::hardware_concurrency(), 1);
+
+	// Filling the maze with walls
+	AllocateWalls(size.x);
+	memset(walls, 0xFF, (storedRooms + 1) / 2);
+
+	// Split the maze into blocks of x-layers. Two rooms share one byte of walls,
+	// so with an odd number of rooms in a layer block borders are kept on even layers.
+	int sliceSize = size.y*size.z*size.w;
+	std::vector<int> borders;
+	borders.push_back(0);
+	for (int b = 1; b < threads; b++)
+	{
+		int border = b * size.x / threads;
+		if (sliceSize % 2 != 0)
+			border &= ~1;
+		if (border > borders.back())
+			borders.push_back(border);
+	}
+	borders.push_back(size.x);
+	int blocksCount = (int)borders.size() - 1;
+
+	// Every block gets its own random sequence, derived from the main one,
+	// so the maze depends only on the seed and the threads count
+	Random* rnd = Random::GetInstance();
+	int blockSeed = rnd->GetInt(0, INT_MAX / 2);
+
+	#pragma omp parallel for num_threads(threads)
+	for (int b = 0; b < blocksCount; b++)
+	{
+		Random blockRnd;
+		blockRnd.Init(blockSeed + b);
+		CarveBlock(borders[b], borders[b + 1], &blockRnd);
+	}
+
+	// Every block is a spanning tree of its rooms. Join them into one tree with
+	// union-find: exactly one passage is opened between every pair of adjacent blocks.
+	std::vector<int> passages; // block b is joined with block b + 1
+	for (int b = 0; b + 1 < blocksCount; b++)
+		passages.push_back(b);
+	for (int i = (int)passages.size() - 1; i > 0; i--)
+		std::swap(passages[i], passages[rnd->GetInt(0, i)]);
+
+	std::vector<int> blockSet(blocksCount);
+	for (int b = 0; b < blocksCount; b++)
+		blockSet[b] = b;
+	auto findSet = [&](int b)
+	{
+		while (blockSet[b] != b)
+			b = blockSet[b] = blockSet[blockSet[b]];
+		return b;
+	};
+
+	for (size_t i = 0; i < passages.size(); i++)
+	{
+		int b = passages[i];
+		int setA = findSet(b);
+		int setB = findSet(b + 1);
+		if (setA == setB)
+			continue;
+		blockSet[setB] = setA;
+
+		// Random room on the last layer of block b, opened towards block b + 1
+		int room = GetIndex(borders[b + 1] - 1,
+			rnd->GetInt(0, size.y - 1),
+			rnd->GetInt(0, size.z - 1),
+			rnd->GetInt(0, size.w - 1));
+		RemoveWall(room, POS_X);
+	}
+
+	generatedSlabs = size.x;
+}
+
+void Maze::BeginStream(int windowSlabs)
+{
+	int sliceSize = size.y*size.z*size.w;
+	AllocateWalls(glm::clamp(windowSlabs, 1, size.x));
+	generatedSlabs = 0;
+
+	streamRnd.Init(Random::GetInstance()->GetInt(0, INT_MAX / 2));
+
+	// Every room of the first layer is a set of its own
+	layerSets.resize(sliceSize);
+	layerRoots.resize(sliceSize);
+	layerCounts.resize(sliceSize);
+	for (int r = 0; r < sliceSize; r++)
+		layerSets[r] = r;
+
+	// Walls between rooms of one layer
+	layerEdges.clear();
+	for (int r = 0; r < sliceSize; r++)
 	{
-		for (int y = 0; y < size.y; y++)
+		glm::ivec4 pos = GetRoomPos(r);
+		for (int e = POS_Y; e < EDGES_COUNT; e += 2)
+			if (pos[e / 2] < size[e / 2] - 1)
+				layerEdges.push_back(r * EDGES_COUNT + e);
+	}
+}
+
+int Maze::NextSlab()
+{
+	assert(generatedSlabs < size.x);
+	int x = generatedSlabs++;
+	bool isLastSlab = (x == size.x - 1);
+	int sliceSize = size.y*size.z*size.w;
+	int firstRoom = (x % storedSlabs) * sliceSize;
+
+	auto findSet = [&](int r)
+	{
+		while (layerSets[r] != r)
+			r = layerSets[r] = layerSets[layerSets[r]];
+		return r;
+	};
+
+	// The layer takes the place of the oldest one, filling it with walls
+	for (int r = firstRoom; r < firstRoom + sliceSize; r++)
+		walls[r >> 1] |= 0xF << ((r & 1) * 4);
+
+	// Join rooms of different sets in random order (randomized Kruskal),
+	// the last layer has to join all of them
+	for (int i = (int)layerEdges.size() - 1; i > 0; i--)
+		std::swap(layerEdges[i], layerEdges[streamRnd.GetInt(0, i)]);
+
+	for (size_t i = 0; i < layerEdges.size(); i++)
+	{
+		int r = layerEdges[i] / EDGES_COUNT;
+		int edge = layerEdges[i] % EDGES_COUNT;
+		int setA = findSet(r);
+		int setB = findSet(r + strides[edge]);
+		if (setA != setB && (isLastSlab || streamRnd.GetInt(0, 1) == 1))
 		{
-			for (int z = 0; z < size.z; z++)
-			{
-				for (int w = 0; w < size.w; w++)
-				{
-					int index = GetIndex(x, y, z, w);
-					for (int i = 0; i < EDGES_COUNT; i++)
-						rooms[index].walls[i] = true;
-					rooms[index].visited = false;
-				}
-			}
+			layerSets[setB] = setA;
+			RemoveWall(firstRoom + r, edge);
 		}
 	}
 
-	rooms[GetIndex(size.x - 1, size.y - 1, size.z - 1, size.w - 1)].visited = true;
-	int unvisitedCells = size.x*size.y*size.z*size.w - 1;
-	int curRoomX = size.x - 1, curRoomY = size.y - 1, curRoomZ = size.z - 1, curRoomW = size.w - 1;
-	std::vector<int> stackX, stackY, stackZ, stackW;
+	if (isLastSlab)
+		return x;
 
-	Random* rnd = Random::GetInstance();
+	// Every set goes on to the next layer through at least one room.
+	// Rooms of the next layer, which aren't connected with this one, start their own sets.
+	for (int r = 0; r < sliceSize; r++)
+	{
+		layerRoots[r] = findSet(r);
+		layerCounts[r] = 0;
+	}
+	for (int r = 0; r < sliceSize; r++)
+		layerCounts[layerRoots[r]]++;
 
-	while (unvisitedCells > 0)
+	// layerCounts of the root is reused as the first room of the set in the next layer
+	for (int r = 0; r < sliceSize; r++)
 	{
-		std::vector<int> curNeighbours = FindUnvisitedNeighbours(curRoomX, curRoomY, curRoomZ, curRoomW);
-		if (curNeighbours.size() != 0)
+		int root = layerRoots[r];
+		bool isSetCarried = layerCounts[root] < 0;
+		bool isLastRoomOfSet = !isSetCarried && --layerCounts[root] == 0;
+		if (isLastRoomOfSet || streamRnd.GetInt(0, 1) == 1)
 		{
-			int randNeighbour = rnd->GetInt(0, curNeighbours.size() - 1);
-			stackX.push_back(curRoomX);
-			stackY.push_back(curRoomY);
-			stackZ.push_back(curRoomZ);
-			stackW.push_back(curRoomW);
-			switch (curNeighbours[randNeighbour])
-			{
-			case NEG_X:
-				rooms[GetIndex(curRoomX, curRoomY, curRoomZ, curRoomW)].walls[NEG_X] = false;
-				curRoomX--;
-				rooms[GetIndex(curRoomX, curRoomY, curRoomZ, curRoomW)].walls[POS_X] = false;
-				break;
-			case POS_X:
-				rooms[GetIndex(curRoomX, curRoomY, curRoomZ, curRoomW)].walls[POS_X] = false;
-				curRoomX++;
-				rooms[GetIndex(curRoomX, curRoomY, curRoomZ, curRoomW)].walls[NEG_X] = false;
-				break;
-			case NEG_Y:
-				rooms[GetIndex(curRoomX, curRoomY, curRoomZ, curRoomW)].walls[NEG_Y] = false;
-				curRoomY--;
-				rooms[GetIndex(curRoomX, curRoomY, curRoomZ, curRoomW)].walls[POS_Y] = false;
-				break;
-			case POS_Y:
-				rooms[GetIndex(curRoomX, curRoomY, curRoomZ, curRoomW)].walls[POS_Y] = false;
-				curRoomY++;
-				rooms[GetIndex(curRoomX, curRoomY, curRoomZ, curRoomW)].walls[NEG_Y] = false;
-				break;
-			case NEG_Z:
-				rooms[GetIndex(curRoomX, curRoomY, curRoomZ, curRoomW)].walls[NEG_Z] = false;
-				curRoomZ--;
-				rooms[GetIndex(curRoomX, curRoomY, curRoomZ, curRoomW)].walls[POS_Z] = false;
-				break;
-			case POS_Z:
-				rooms[GetIndex(curRoomX, curRoomY, curRoomZ, curRoomW)].walls[POS_Z] = false;
-				curRoomZ++;
-				rooms[GetIndex(curRoomX, curRoomY, curRoomZ, curRoomW)].walls[NEG_Z] = false;
-				break;
-			case NEG_W:
-				rooms[GetIndex(curRoomX, curRoomY, curRoomZ, curRoomW)].walls[NEG_W] = false;
-				curRoomW--;
-				rooms[GetIndex(curRoomX, curRoomY, curRoomZ, curRoomW)].walls[POS_W] = false;
-				break;
-			case POS_W:
-				rooms[GetIndex(curRoomX, curRoomY, curRoomZ, curRoomW)].walls[POS_W] = false;
-				curRoomW++;
-				rooms[GetIndex(curRoomX, curRoomY, curRoomZ, curRoomW)].walls[NEG_W] = false;
-				break;
-			default:
-				break;
-			}
-			rooms[GetIndex(curRoomX, curRoomY, curRoomZ, curRoomW)].visited = true;
-			unvisitedCells--;
+			RemoveWall(firstRoom + r, POS_X);
+			if (!isSetCarried)
+				layerCounts[root] = -1 - r;
+			layerSets[r] = -1 - layerCounts[root];
 		}
-		else if (stackX.size() != 0 && stackY.size() != 0 && stackZ.size() != 0 && stackW.size() != 0)
+		else
 		{
-			curRoomX = stackX[stackX.size() - 1];
-			stackX.pop_back();
-			curRoomY = stackY[stackY.size() - 1];
-			stackY.pop_back();
-			curRoomZ = stackZ[stackZ.size() - 1];
-			stackZ.pop_back();
-			curRoomW = stackW[stackW.size() - 1];
-			stackW.pop_back();
+			layerSets[r] = r;
 		}
 	}
+
+	return x;
 }
 
-std::vector<int> Maze::FindUnvisitedNeighbours(int curX, int curY, int curZ, int curW)
+// Depth-first carving of the rooms with x in [x0, x1)
+void Maze::CarveBlock(const int x0, const int x1, Random* rnd)
 {
-	std::vector<int> neighbours;
+	int sliceSize = size.y*size.z*size.w;
+	int blockRooms = (x1 - x0) * sliceSize;
+	int firstRoom = x0 * sliceSize;
+
+	int visitedWords = (blockRooms + 31) / 32;
+	uint32_t* visited = new uint32_t[visitedWords];
+	memset(visited, 0, visitedWords * sizeof(uint32_t));
+
+	glm::ivec4 curPos = glm::ivec4(x1 - 1, size.y - 1, size.z - 1, size.w - 1);
+	int curRoom = GetIndex(curPos.x, curPos.y, curPos.z, curPos.w);
+	SetVisited(visited, curRoom - firstRoom);
+	int unvisitedCells = blockRooms - 1;
+
+	// Every step pushes exactly one room, so the path can't be longer than the block
+	int* stack = new int[blockRooms];
+	int stackSize = 0;
 
-	if (curX > 0            && !rooms[GetIndex(curX - 1, curY, curZ, curW)].visited) { neighbours.push_back(NEG_X); }
-	if (curX < (size.x - 1) && !rooms[GetIndex(curX + 1, curY, curZ, curW)].visited) { neighbours.push_back(POS_X); }
+	while (unvisitedCells > 0)
+	{
+		int neighbours = FindUnvisitedNeighbours(curRoom, curPos, x0, x1, visited, firstRoom);
+		if (neighbours != 0)
+		{
+			int neighboursCount = 0;
+			for (int e = 0; e < EDGES_COUNT; e++)
+				neighboursCount += (neighbours >> e) & 1;
 
-	if (curY > 0            && !rooms[GetIndex(curX, curY - 1, curZ, curW)].visited) { neighbours.push_back(NEG_Y); }
-	if (curY < (size.y - 1) && !rooms[GetIndex(curX, curY + 1, curZ, curW)].visited) { neighbours.push_back(POS_Y); }
+			// Pick the n-th set bit, in the same edge order the maze was always built with
+			int randNeighbour = rnd->GetInt(0, neighboursCount - 1);
+			int edge = 0;
+			for (; edge < EDGES_COUNT; edge++)
+				if (((neighbours >> edge) & 1) != 0 && randNeighbour-- == 0)
+					break;
 
-	if (curZ > 0            && !rooms[GetIndex(curX, curY, curZ - 1, curW)].visited) { neighbours.push_back(NEG_Z); }
-	if (curZ < (size.z - 1) && !rooms[GetIndex(curX, curY, curZ + 1, curW)].visited) { neighbours.push_back(POS_Z); }
+			stack[stackSize++] = curRoom;
 
-	if (curW > 0            && !rooms[GetIndex(curX, curY, curZ, curW - 1)].visited) { neighbours.push_back(NEG_W); }
-	if (curW < (size.w - 1) && !rooms[GetIndex(curX, curY, curZ, curW + 1)].visited) { neighbours.push_back(POS_W); }
+			RemoveWall(curRoom, edge);
+			curRoom += strides[edge];
+			curPos[edge / 2] += (edge % 2 == 0) ? -1 : 1;
+
+			SetVisited(visited, curRoom - firstRoom);
+			unvisitedCells--;
+		}
+		else if (stackSize > 0)
+		{
+			curRoom = stack[--stackSize];
+			curPos = GetRoomPos(curRoom);
+		}
+	}
+
+	delete[] stack;
+	delete[] visited;
+}
+
+int Maze::FindUnvisitedNeighbours(const int index, const glm::ivec4& pos, const int x0, const int x1,
+	const uint32_t* visited, const int firstRoom)
+{
+	int neighbours = 0;
+
+	for (int e = 0; e < EDGES_COUNT; e++)
+	{
+		int axis = e / 2;
+		int minPos = axis == AXIS_X ? x0 : 0;
+		int maxPos = axis == AXIS_X ? x1 - 1 : size[axis] - 1;
+		bool isInside = (e % 2 == 0) ? pos[axis] > minPos : pos[axis] < maxPos;
+		if (isInside && !IsVisited(visited, index + strides[e] - firstRoom))
+			neighbours |= 1 << e;
+	}
 
 	return neighbours;
 }
@@ -139,6 +312,16 @@ int Maze::GetIndex(const int x, const int y, const int z, const int w)
 	return x*size.y*size.z*size.w + y*size.z*size.w + z*size.w + w;
 };
 
+glm::ivec4 Maze::GetRoomPos(int index)
+{
+	glm::ivec4 pos;
+	pos.w = index % size.w; index /= size.w;
+	pos.z = index % size.z; index /= size.z;
+	pos.y = index % size.y; index /= size.y;
+	pos.x = index;
+	return pos;
+}
+
 bool Maze::IsRoomIndexValid(int x, int y, int z, int w)
 {
 	return (
@@ -2,6 +2,12 @@
 
 #include <Utils.h>
 
+#include <thread>
+
+#define MAZE_ALGORITHM_DFS 0
+#define MAZE_ALGORITHM_PARALLEL 1
+#define MAZE_ALGORITHM_STREAM 2
+
 class Maze
 {
 public:
@@ -10,21 +16,62 @@ public:
 
 	bool IsWallExist(int edge, glm::ivec4 pos);
 
+	// Single-threaded depth-first search
 	void Generate();
 
+	// Depth-first search in blocks of x-layers, one block per thread.
+	// Same seed and threads count give the same maze (0 threads - number of CPU cores)
+	void GenerateParallel(int threads);
+
+	// Streaming generation with Eller's algorithm, one x-layer of rooms at a time.
+	// Only the last windowSlabs layers are kept in memory, so IsWallExist works for them only
+	// (NEG_X walls of a layer are stored in the previous one).
+	void BeginStream(int windowSlabs);
+	// Generates the next layer and returns its x
+	int NextSlab();
+
+	bool IsGenerated() const { return walls != nullptr; }
+
 	const glm::ivec4 size;
 
 private:
-	std::vector<int> FindUnvisitedNeighbours(int curX, int curY, int curZ, int curW);
+	void AllocateWalls(const int slabs);
+
+	void CarveBlock(const int x0, const int x1, Random* rnd);
+
+	// Bitmask of edges leading to unvisited rooms of the block (bit number == edge number)
+	int FindUnvisitedNeighbours(const int index, const glm::ivec4& pos, const int x0, const int x1,
+		const uint32_t* visited, const int firstRoom);
+
+	void RemoveWall(const int index, const int edge);
 
 	int GetIndex(const int x, const int y, const int z, const int w);
 
+	glm::ivec4 GetRoomPos(int index);
+
 	bool IsRoomIndexValid(int x, int y, int z, int w);
 
-	struct Room
-	{
-		bool walls[EDGES_COUNT];
-		bool visited;
-	};
-	Room* rooms = nullptr;
+	// Visited rooms are a bitset, which exists only during generation
+	static bool IsVisited(const uint32_t* visited, const int index) { return (visited[index >> 5] >> (index & 31)) & 1; }
+	static void SetVisited(uint32_t* visited, const int index) { visited[index >> 5] |= 1u << (index & 31); }
+
+	// Only positive walls are stored: 4 bits per room (bit n - POS wall of axis n),
+	// two rooms per byte. Negative wall of a room is the positive wall of its neighbour.
+	uint8_t* walls = nullptr;
+
+	// Number of stored x-layers (all of them, unless streaming)
+	int storedSlabs = 0;
+	int storedRooms = 0;
+	// Number of generated x-layers
+	int generatedSlabs = 0;
+
+	// Room index offset to the neighbouring room for each edge
+	int strides[EDGES_COUNT];
+
+	// Eller's algorithm state for the last generated layer (indices of rooms inside the layer)
+	Random streamRnd;
+	std::vector<int> layerSets;
+	std::vector<int> layerRoots;
+	std::vector<int> layerCounts;
+	std::vector<int> layerEdges;
 };
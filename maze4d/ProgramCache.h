@@ -0,0 +1,253 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <Utils.h>
+
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
+// Program binaries are core since GL 4.1 (ARB_get_program_binary), but glad is generated for GL 3.3,
+// so the entry points and constants of the cache are loaded here
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+
+#define PROGRAM_CACHE_VERSION 1
+
+// Linked programs saved to files next to config.txt, so the shaders are compiled only on the first launch
+// and after a change of the sources or the driver, not on every launch and window restart.
+// The file is named by the program name and the key: the hash of the sources, the vendor, the renderer and the version of the GL.
+// A binary rejected by the driver (e.g. after a driver update with the same version string) is compiled again.
+// There is one file per program name: the saved one replaces the files of the old keys.
+class ProgramCache
+{
+public:
+	static ProgramCache* GetInstance()
+	{
+		static ProgramCache instance;
+		return &instance;
+	}
+
+	// Loads the entry points from the current context, false if the cache is disabled or the GL has no binaries
+	bool Load(bool isEnabled)
+	{
+		isLoaded = false;
+		if (!isEnabled)
+			return false;
+		if (GLVersion.major < 4 || (GLVersion.major == 4 && GLVersion.minor < 1))
+			if (!glfwExtensionSupported("GL_ARB_get_program_binary"))
+				return false;
+
+		getProgramBinary = (GetProgramBinaryProc)glfwGetProcAddress("glGetProgramBinary");
+		programBinary = (ProgramBinaryProc)glfwGetProcAddress("glProgramBinary");
+		programParameteri = (ProgramParameteriProc)glfwGetProcAddress("glProgramParameteri");
+		if (getProgramBinary == nullptr || programBinary == nullptr || programParameteri == nullptr)
+			return false;
+
+		// Some drivers support the extension without any binary format
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		isLoaded = formats > 0;
+		return isLoaded;
+	}
+
+	bool IsLoaded() const { return isLoaded; }
+
+	// Key of the program of these sources with the current driver
+	uint64_t GetKey(const std::string& firstSource, const std::string& secondSource = "") const
+	{
+		if (!isLoaded)
+			return 0;
+
+		uint64_t key = FNV_OFFSET;
+		key = Hash(key, firstSource);
+		key = Hash(key, secondSource);
+		key = Hash(key, (const char*)glGetString(GL_VENDOR));
+		key = Hash(key, (const char*)glGetString(GL_RENDERER));
+		key = Hash(key, (const char*)glGetString(GL_VERSION));
+		return key;
+	}
+
+	// Links the program from the saved binary, false if there is none or the driver rejects it
+	bool LoadProgram(GLuint program, const std::string& name, uint64_t key) const
+	{
+		if (!isLoaded)
+			return false;
+
+		std::ifstream file(GetFileName(name, key), std::ios::binary);
+		if (!file.is_open())
+			return false;
+
+		Header header;
+		Header expected = GetHeader(key, 0, 0);
+		if (!file.read((char*)&header, sizeof(Header)) || memcmp(header.magic, expected.magic, 4) != 0 ||
+			header.version != expected.version || header.key != key)
+			return false;
+
+		std::vector<char> binary(header.length);
+		if (header.length == 0 || !file.read(binary.data(), header.length))
+			return false;
+
+		programBinary(program, header.format, binary.data(), header.length);
+		GLint isLinked = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &isLinked);
+		if (isLinked != GL_TRUE)
+		{
+			Log("Shader cache ", GetFileName(name, key), " is rejected by the driver, the shader is compiled");
+			return false;
+		}
+		return true;
+	}
+
+	// Asks the driver to keep the binary of the program, before it is linked
+	void PrepareLink(GLuint program) const
+	{
+		if (isLoaded)
+			programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+
+	// Saves the binary of the linked program and removes the stale binaries of the same name
+	void SaveProgram(GLuint program, const std::string& name, uint64_t key) const
+	{
+		if (!isLoaded)
+			return;
+
+		GLint isLinked = GL_FALSE;
+		GLint length = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &isLinked);
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (isLinked != GL_TRUE || length <= 0)
+			return;
+
+		std::vector<char> binary(length);
+		GLenum format = 0;
+		getProgramBinary(program, length, &length, &format, binary.data());
+
+		std::string fileName = GetFileName(name, key);
+		std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+		Header header = GetHeader(key, format, uint32_t(length));
+		if (!file.write((const char*)&header, sizeof(Header)) || !file.write(binary.data(), length))
+		{
+			Log("Unable to write shader cache ", fileName);
+			return;
+		}
+		file.close();
+		RemoveStalePrograms(name, fileName);
+	}
+
+	typedef void (APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+	typedef void (APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+	typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+
+	GetProgramBinaryProc getProgramBinary = nullptr;
+	ProgramBinaryProc programBinary = nullptr;
+	ProgramParameteriProc programParameteri = nullptr;
+
+private:
+	ProgramCache() {}
+
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t key;
+		uint32_t format;
+		uint32_t length;
+	};
+
+	static Header GetHeader(uint64_t key, uint32_t format, uint32_t length)
+	{
+		Header header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, "M4DP", 4);
+		header.version = PROGRAM_CACHE_VERSION;
+		header.key = key;
+		header.format = format;
+		header.length = length;
+		return header;
+	}
+
+	static std::string GetFilePrefix(const std::string& name)
+	{
+		return "shader_" + name + "_";
+	}
+
+	static std::string GetFileName(const std::string& name, uint64_t key)
+	{
+		std::stringstream stream;
+		stream << GetFilePrefix(name) << std::hex << key << ".bin";
+		return stream.str();
+	}
+
+	// Removes the binaries of the program with the other keys: the sources or the driver have changed since them
+	static void RemoveStalePrograms(const std::string& name, const std::string& keptFileName)
+	{
+		std::string prefix = GetFilePrefix(name);
+		std::vector<std::string> files;
+#ifdef _WIN32
+		Windows::WIN32_FIND_DATAA fileData;
+		Windows::HANDLE find = Windows::FindFirstFileA((prefix + "*.bin").c_str(), &fileData);
+		if (find == (Windows::HANDLE)(Windows::LONG_PTR)-1)
+			return;
+		do
+			files.push_back(fileData.cFileName);
+		while (Windows::FindNextFileA(find, &fileData));
+		Windows::FindClose(find);
+#else
+		DIR* dir = opendir(".");
+		if (dir == nullptr)
+			return;
+		while (dirent* entry = readdir(dir))
+		{
+			std::string fileName = entry->d_name;
+			if (fileName.size() > prefix.size() + 4 && fileName.compare(0, prefix.size(), prefix) == 0 &&
+				fileName.compare(fileName.size() - 4, 4, ".bin") == 0)
+				files.push_back(fileName);
+		}
+		closedir(dir);
+#endif
+
+		for (const std::string& fileName : files)
+		{
+			// The key is hex, so the prefix of another name can't match it (e.g. "a_" and "a_b_")
+			bool isKey = fileName.find_first_not_of("0123456789abcdef", prefix.size()) == fileName.size() - 4;
+			if (fileName != keptFileName && isKey)
+			{
+				Log("Shader cache ", fileName, " is removed");
+				std::remove(fileName.c_str());
+			}
+		}
+	}
+
+	// FNV-1a over the bytes and the length, so the strings can't shift into each other
+	static uint64_t Hash(uint64_t hash, const std::string& text)
+	{
+		for (unsigned char c : text)
+		{
+			hash ^= c;
+			hash *= FNV_PRIME;
+		}
+		hash ^= uint64_t(text.size());
+		hash *= FNV_PRIME;
+		return hash;
+	}
+
+	static uint64_t Hash(uint64_t hash, const char* text)
+	{
+		return Hash(hash, std::string(text != nullptr ? text : ""));
+	}
+
+	static const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+	static const uint64_t FNV_PRIME = 1099511628211ULL;
+
+	bool isLoaded = false;
+};
@@ -18,7 +18,8 @@ public:
 	}
 
 	// uses DDA algo (from https://lodev.org/cgtutor/raycasting.html)
-	void FindPixel(glm::vec4 pos, glm::vec4 v, glm::u8vec3& pixel, float& dist)
+	// returns the number of DDA steps
+	int FindPixel(glm::vec4 pos, glm::vec4 v, glm::u8vec3& pixel, float& dist)
 	{
 		//which box of the map we're in
 		glm::ivec4 map(pos);
@@ -79,10 +80,16 @@ public:
 
 		Cell_t cell = 0;
 		Light_t light = 0;
-		int index = 0;
+		//index follows the steps, so it is only moved along the stepped axis
+		if (!field->IsCubeIndexValid(map.x, map.y, map.z, map.w))
+			return 0;
+		int64_t index = field->GetIndex(map.x, map.y, map.z, map.w);
+		int steps = 0;
 		//perform DDA
 		while (true)
 		{
+			steps++;
+
 			//jump to next map square, OR in x-direction, OR in y-direction
 			if (sideDist.x <= sideDist.y && sideDist.x <= sideDist.z && sideDist.x <= sideDist.w)
 			{
@@ -102,59 +109,89 @@ public:
 				map.z += step.z;
 				side = 2;
 			}
-			else if (sideDist.w < sideDist.x && sideDist.w <= sideDist.y && sideDist.w <= sideDist.z)
+			else
 			{
 				sideDist.w += deltaDist.w;
 				map.w += step.w;
 				side = 3;
 			}
 
-			if (!field->IsCubeIndexValid(map.x, map.y, map.z, map.w))
-				return;
+			if (map[side] < 0 || map[side] >= field->size[side])
+				return steps;
 
 			//Check if ray has hit a wall
-			index = field->GetIndex(map.x, map.y, map.z, map.w);
-			cell = field->curMap[index];
+			index = field->MoveIndex(index, side, map[side] - step[side], map[side]);
+			cell = field->GetCell(index);
 			if ((cell & WALL_BLOCK) != 0)
 				break;
+
+			//leap over the empty cubes around: the cubes closer than the distance are empty,
+			//so every axis makes the steps, which DDA would make until the ray leaves them
+			int distance = skipEmptySpace ? field->GetDistance(index) : 0;
+			if (distance > 1)
+			{
+				glm::vec4 exitDist = sideDist;
+				for (int i = 1; i < distance; i++)
+					exitDist += deltaDist;
+				int exitSide = 0;
+				for (int a = 1; a < 4; a++)
+					if (exitDist[a] < exitDist[exitSide])
+						exitSide = a;
+
+				for (int a = 0; a < 4; a++)
+				{
+					int from = map[a];
+					//DDA steps along the lower axis first on the same distance
+					while (sideDist[a] < exitDist[exitSide] || (sideDist[a] == exitDist[exitSide] && a < exitSide))
+					{
+						sideDist[a] += deltaDist[a];
+						map[a] += step[a];
+					}
+					index = field->MoveIndex(index, a, from, map[a]);
+				}
+			}
 		}
 
+		light = field->GetLight(index);
+
 		//Calculate distance projected on camera direction (Euclidean distance will give fisheye effect!)
 		if (side == 0)
 		{
 			dist = (map.x - pos.x + (1 - step.x) / 2.0f) / v.x;
 			glm::vec4 texPoint = pos + v*dist;
 			Cube::GetPixel(pos.x < map.x ? NEG_X : POS_X, pixel, glm::vec3(texPoint.y, texPoint.z, texPoint.w),
-				map.x, map.y, map.z, map.w, cell, field->curLightMap[index]);
+				map.x, map.y, map.z, map.w, cell, light);
 		}
 		else if (side == 1)
 		{
 			dist = (map.y - pos.y + (1 - step.y) / 2.0f) / v.y;
 			glm::vec4 texPoint = pos + v*dist;
 			Cube::GetPixel(pos.y < map.y ? NEG_Y : POS_Y, pixel, glm::vec3(texPoint.x, texPoint.z, texPoint.w),
-				map.x, map.y, map.z, map.w, cell, field->curLightMap[index]);
+				map.x, map.y, map.z, map.w, cell, light);
 		}
 		else if (side == 2)
 		{
 			dist = (map.z - pos.z + (1 - step.z) / 2.0f) / v.z;
 			glm::vec4 texPoint = pos + v*dist;
 			Cube::GetPixel(pos.z < map.z ? NEG_Z : POS_Z, pixel, glm::vec3(texPoint.x, texPoint.y, texPoint.w),
-				map.x, map.y, map.z, map.w, cell, field->curLightMap[index]);
+				map.x, map.y, map.z, map.w, cell, light);
 		}
 		else if (side == 3)
 		{
 			dist = (map.w - pos.w + (1 - step.w) / 2.0f) / v.w;
 			glm::vec4 texPoint = pos + v*dist;
 			Cube::GetPixel(pos.w < map.w ? NEG_W : POS_W, pixel, glm::vec3(texPoint.x, texPoint.y, texPoint.z),
-				map.x, map.y, map.z, map.w, cell, field->curLightMap[index]);
+				map.x, map.y, map.z, map.w, cell, light);
 		}
+
+		return steps;
 	}
 
 	static int FindCollision(glm::vec4 pos, glm::vec4 v, float targetDist, float& safeDist, Cell_t& collideCell, bool noclip, Field* field)
 	{
 		glm::vec4 tmp;
 		glm::ivec4 map(tmp);
-		int index;
+		int64_t index;
 		Cell_t cell;
 		float step = 0.01f;
 		for (float i = 0.0f; ; i += step)
@@ -174,7 +211,7 @@ public:
 			{
 				// Check if ray has hit a wall
 				index = field->GetIndex(map.x, map.y, map.z, map.w);
-				cell = field->curMap[index];
+				cell = field->GetCell(index);
 				collideCell = cell;
 				if ((cell & WALL_BLOCK) != 0 && (cell & LIGHT_BLOCK) == 0 && (cell & WIN_BLOCK) == 0)
 				{
@@ -191,6 +228,10 @@ public:
 		}
 	}
 
+	// Leap over the empty space by the distances of the field. It gives the same pixels in fewer steps,
+	// but the CPU steps are cheap and with the default room size it does not pay off (see the benchmark)
+	bool skipEmptySpace = false;
+
 private:
 	Field* field = nullptr;
 };
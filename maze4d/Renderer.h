@@ -48,8 +48,9 @@ public:
 			else
 				if (x % 2 == (skipEven == 0 ? 1 : 0)) return;
 
-		float dY = (float(y - H2) / W2);
-		float dX = (float(x - W2) / W2);
+		//the ray goes through the pixel center, as the one of the GPU render
+		float dY = ((y + 0.5f - H2) / W2);
+		float dX = ((x + 0.5f - W2) / W2);
 
 		glm::vec4 rayDy = player->vy * dY;
 		glm::vec4 rayDx = player->vz * dX;
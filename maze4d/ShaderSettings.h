@@ -0,0 +1,98 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <shader.h>
+
+// Uniform buffer binding of the Settings block of FragmentRaycasting4d.hlsl (the Views block has 0)
+#define SETTINGS_BINDING 1
+
+// Settings of the raycaster, which change only with the maze or the config: they are kept in one uniform buffer,
+// which is uploaded on a change and shared by the programs (the fragment and the compute raycaster).
+// The buffer belongs to the GL context: Reset deletes it before the window is destroyed and the next Upload creates it
+// in the context of the new window.
+class ShaderSettings
+{
+public:
+	static ShaderSettings* GetInstance()
+	{
+		static ShaderSettings instance;
+		return &instance;
+	}
+
+	// Connects the Settings block of the raycaster to the buffer
+	static void BindShader(Shader* raycaster)
+	{
+		raycaster->BindUniformBlock("Settings", SETTINGS_BINDING);
+	}
+
+	// zSlices is the number of z-slices in a group of the map texture (see Field::GetTextureZSlices)
+	void SetMapSize(const glm::ivec4& mapSize, int zSlices)
+	{
+		block.mapSize = mapSize;
+		block.mapZSlices = zSlices;
+		block.mapZGroups = (mapSize.z + zSlices - 1) / zSlices;
+		Upload();
+	}
+
+	void SetResolution(int viewWidth, int viewHeight)
+	{
+		block.gameResolution = glm::ivec2(viewWidth, viewHeight);
+		Upload();
+	}
+
+	void SetCpuRender(int cpuRender)
+	{
+		block.CpuRender = cpuRender;
+		Upload();
+	}
+
+	void SetAntiAliasing(int antiAliasing)
+	{
+		block.AntiAliasingEnabled = antiAliasing;
+		Upload();
+	}
+
+	// Deletes the buffer, while the context of the window is current
+	void Reset()
+	{
+		if (UBO != 0)
+			glDeleteBuffers(1, &UBO);
+		UBO = 0;
+	}
+
+private:
+	ShaderSettings() {}
+
+	void Upload()
+	{
+		if (UBO == 0)
+		{
+			glGenBuffers(1, &UBO);
+			glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+			glBufferData(GL_UNIFORM_BUFFER, sizeof(SettingsBlock), nullptr, GL_STATIC_DRAW);
+		}
+		else
+			glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(SettingsBlock), &block);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, SETTINGS_BINDING, UBO);
+	}
+
+	// std140 layout of the Settings block, its size is rounded up to 16 bytes
+	struct SettingsBlock
+	{
+		glm::ivec4 mapSize;
+		glm::ivec2 gameResolution;
+		GLint CpuRender;
+		GLint AntiAliasingEnabled;
+		GLint mapZSlices;
+		GLint mapZGroups;
+		GLint padding[2];
+	};
+	static_assert(sizeof(SettingsBlock) % 16 == 0, "std140 block size is a multiple of 16");
+
+	SettingsBlock block = { glm::ivec4(1), glm::ivec2(1), 1, 0, 1, 1, { 0, 0 } };
+	GLuint UBO = 0;
+};
@@ -67,14 +67,14 @@ public:
 			return tex_new[GetIndex(x, y, z, l)];
 	}
 
+	// The texel coordinates are wrapped by the reader (see Cube::GetPixel)
 	int Size() {
-		// +1 for the case when int(texCoord * TEX_SIZE) == TEX_SIZE
-		return (TEX_SIZE + 1)*(TEX_SIZE + 1)*(TEX_SIZE + 1)*(LIGHT_GRAD);
+		return TEX_SIZE*TEX_SIZE*TEX_SIZE*LIGHT_GRAD;
 	}
 
 	int GetIndex(const int x, const int y, const int z, const int l)
 	{
-		return x*(TEX_SIZE + 1)*(TEX_SIZE + 1)*LIGHT_GRAD + y*(TEX_SIZE + 1)*LIGHT_GRAD + z * LIGHT_GRAD + l;
+		return x*TEX_SIZE*TEX_SIZE*LIGHT_GRAD + y*TEX_SIZE*LIGHT_GRAD + z * LIGHT_GRAD + l;
 	};
 };
 
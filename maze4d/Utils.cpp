@@ -1,5 +1,7 @@
 #include <Utils.h>
 
+#include <sstream>
+
 static Random _instance;
 
 Random* Random::GetInstance()
@@ -26,3 +28,16 @@ int Random::GetInt(int a, int b)
 	std::uniform_int_distribution<> dist(a, b);
 	return dist(engine);
 }
+
+std::string Random::GetState()
+{
+	std::stringstream stream;
+	stream << engine;
+	return stream.str();
+}
+
+void Random::SetState(const std::string& state)
+{
+	std::stringstream stream(state);
+	stream >> engine;
+}
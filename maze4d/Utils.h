@@ -146,6 +146,10 @@ public:
 
 	int GetInt(int a, int b);
 
+	// Engine state as text, to continue the same sequence later
+	std::string GetState();
+	void SetState(const std::string& state);
+
 private:
 	std::default_random_engine engine;
 };
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <shader.h>
+#include <Player.h>
+
+// Views of the raycaster in one pass, the size of the array in the Views block of FragmentRaycasting4d.hlsl
+#define MAX_VIEWS 4
+// Uniform buffer binding of the Views block
+#define VIEWS_BINDING 0
+
+// Cameras of the views, which the raycaster renders in one pass: the main view and the insets over it
+// (the W rear views). A pixel belongs to the last view, whose rectangle has it.
+// The cameras of the previous frame go along for the temporal anti-aliasing.
+class ViewBuffer
+{
+public:
+	ViewBuffer()
+	{
+		glGenBuffers(1, &UBO);
+		glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(ViewBlock), nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, VIEWS_BINDING, UBO);
+	}
+
+	~ViewBuffer()
+	{
+		// The buffer may outlive the GL context (e.g. on exit)
+		if (glfwGetCurrentContext() == nullptr)
+			return;
+
+		glDeleteBuffers(1, &UBO);
+	}
+
+	// Connects the Views block of the raycaster to the buffer
+	static void BindShader(Shader* raycaster)
+	{
+		raycaster->BindUniformBlock("Views", VIEWS_BINDING);
+	}
+
+	void Clear()
+	{
+		count = 0;
+	}
+
+	// The rectangle is in the -1.0f...1.0f viewport as for GameGraphics, the first view covers the others
+	void Add(const Player& camera, float bottomX, float bottomY, float width, float height)
+	{
+		if (count >= MAX_VIEWS)
+			return;
+
+		cameras[count] = camera;
+		block.rect[count] = glm::vec4((bottomX + 1.0f) / 2.0f, (bottomY + 1.0f) / 2.0f, width / 2.0f, height / 2.0f);
+		count++;
+	}
+
+	// Uploads the views, the cameras become the history of the next frame
+	void Upload()
+	{
+		for (int i = 0; i < count; i++)
+		{
+			const Player& camera = cameras[i];
+			// A new view has no history, the temporal anti-aliasing drops it by the hits
+			const Player& history = i < historyCount ? historyCameras[i] : camera;
+			block.vx[i] = camera.vx;
+			block.vy[i] = camera.vy;
+			block.vz[i] = camera.vz;
+			block.vw[i] = camera.vw;
+			block.pos[i] = camera.pos;
+			block.historyVx[i] = history.vx;
+			block.historyVy[i] = history.vy;
+			block.historyVz[i] = history.vz;
+			block.historyVw[i] = history.vw;
+			block.historyPos[i] = history.pos;
+			historyCameras[i] = camera;
+		}
+		block.count = count;
+		historyCount = count;
+
+		glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ViewBlock), &block);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, VIEWS_BINDING, UBO);
+	}
+
+private:
+	// std140 layout of the Views block: vec4 arrays are packed, the int is padded to a vec4
+	struct ViewBlock
+	{
+		glm::vec4 rect[MAX_VIEWS];
+		glm::vec4 vx[MAX_VIEWS];
+		glm::vec4 vy[MAX_VIEWS];
+		glm::vec4 vz[MAX_VIEWS];
+		glm::vec4 vw[MAX_VIEWS];
+		glm::vec4 pos[MAX_VIEWS];
+		glm::vec4 historyVx[MAX_VIEWS];
+		glm::vec4 historyVy[MAX_VIEWS];
+		glm::vec4 historyVz[MAX_VIEWS];
+		glm::vec4 historyVw[MAX_VIEWS];
+		glm::vec4 historyPos[MAX_VIEWS];
+		GLint count;
+		GLint padding[3];
+	};
+
+	GLuint UBO = 0;
+	ViewBlock block = {};
+	Player cameras[MAX_VIEWS];
+	int count = 0;
+	Player historyCameras[MAX_VIEWS];
+	int historyCount = 0;
+};
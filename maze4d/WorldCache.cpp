@@ -0,0 +1,272 @@
+#include <Field.h>
+
+#include <sstream>
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#endif
+
+#define HEADER_BYTES ((sizeof(Header) + 7) & ~size_t(7))
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+static std::string GetWorldFileName(const WorldKey& key)
+{
+	std::stringstream stream;
+	stream << "world_" << key.seed << "_" << key.mazeSize.x << "x" << key.mazeSize.y << "x" << key.mazeSize.z << "x" << key.mazeSize.w <<
+		"_room" << key.roomSize << "_light" << key.lightDist << "_alg" << key.mazeAlgorithm;
+	if (key.mazeAlgorithm == MAZE_ALGORITHM_PARALLEL)
+		stream << "_threads" << key.mazeThreads;
+	if (key.cellLayout != BRICK_LAYOUT_TILED)
+		stream << "_layout" << key.cellLayout;
+	stream << "_" << std::hex << key.randomState << ".bin";
+	return stream.str();
+}
+
+// Marks the file as the most recently used one
+static void TouchWorldFile(const std::string& fileName)
+{
+#ifdef _WIN32
+	Windows::HANDLE file = Windows::CreateFileA(fileName.c_str(), FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == (Windows::HANDLE)(Windows::LONG_PTR)-1)
+		return;
+
+	Windows::FILETIME now;
+	Windows::GetSystemTimeAsFileTime(&now);
+	Windows::SetFileTime(file, NULL, NULL, &now);
+	Windows::CloseHandle(file);
+#else
+	utime(fileName.c_str(), nullptr);
+#endif
+}
+
+// Removes the least recently used world files, so there are WORLD_CACHE_FILES of them with the kept one
+static void RemoveOldWorldFiles(const std::string& keptFileName)
+{
+	std::vector<std::pair<int64_t, std::string>> files; // modification time and name
+#ifdef _WIN32
+	Windows::WIN32_FIND_DATAA fileData;
+	Windows::HANDLE find = Windows::FindFirstFileA("world_*.bin", &fileData);
+	if (find == (Windows::HANDLE)(Windows::LONG_PTR)-1)
+		return;
+	do
+	{
+		int64_t time = (int64_t(fileData.ftLastWriteTime.dwHighDateTime) << 32) | fileData.ftLastWriteTime.dwLowDateTime;
+		files.push_back(std::make_pair(time, std::string(fileData.cFileName)));
+	} while (Windows::FindNextFileA(find, &fileData));
+	Windows::FindClose(find);
+#else
+	DIR* dir = opendir(".");
+	if (dir == nullptr)
+		return;
+	while (dirent* entry = readdir(dir))
+	{
+		std::string name = entry->d_name;
+		struct stat fileStat;
+		if (name.size() > 10 && name.compare(0, 6, "world_") == 0 && name.compare(name.size() - 4, 4, ".bin") == 0 &&
+			stat(name.c_str(), &fileStat) == 0)
+			files.push_back(std::make_pair(int64_t(fileStat.st_mtime), name));
+	}
+	closedir(dir);
+#endif
+
+	files.erase(std::remove_if(files.begin(), files.end(),
+		[&](const std::pair<int64_t, std::string>& file) { return file.second == keptFileName; }), files.end());
+	std::sort(files.begin(), files.end());
+	for (int i = 0; i < int(files.size()) - (WORLD_CACHE_FILES - 1); i++)
+	{
+		Log("World cache ", files[i].second, " is removed");
+		std::remove(files[i].second.c_str());
+	}
+}
+
+WorldCache::WorldCache(const WorldKey& key) : fileName(GetWorldFileName(key)), key(key)
+{
+}
+
+WorldCache::~WorldCache()
+{
+	Close();
+	if (outputFile.is_open())
+		outputFile.close();
+}
+
+WorldCache::Header WorldCache::GetHeader()
+{
+	Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "M4DW", 4);
+	header.version = WORLD_CACHE_VERSION;
+	header.key = key;
+	header.brickBits = BRICK_BITS;
+	header.cellBytes = sizeof(Cell_t);
+	header.lightBytes = sizeof(Light_t);
+	return header;
+}
+
+uint64_t WorldCache::UpdateChecksum(uint64_t checksum, const uint8_t* data, const uint64_t bytes)
+{
+	for (uint64_t i = 0; i < bytes; i += 8)
+	{
+		uint64_t word = 0;
+		memcpy(&word, data + i, glm::min(bytes - i, uint64_t(8)));
+		checksum ^= word;
+		checksum *= FNV_PRIME;
+	}
+	return checksum;
+}
+
+bool WorldCache::Open()
+{
+	Close();
+
+#ifdef _WIN32
+	file = Windows::CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == (Windows::HANDLE)(Windows::LONG_PTR)-1)
+	{
+		file = nullptr;
+		return false;
+	}
+
+	Windows::LARGE_INTEGER fileSize;
+	if (!Windows::GetFileSizeEx(file, &fileSize) || uint64_t(fileSize.QuadPart) < HEADER_BYTES)
+	{
+		Close();
+		return false;
+	}
+	fileBytes = fileSize.QuadPart;
+
+	mapping = Windows::CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping != nullptr)
+		fileData = (const uint8_t*)Windows::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+	file = open(fileName.c_str(), O_RDONLY);
+	if (file < 0)
+		return false;
+
+	struct stat fileStat;
+	if (fstat(file, &fileStat) != 0 || uint64_t(fileStat.st_size) < HEADER_BYTES)
+	{
+		Close();
+		return false;
+	}
+	fileBytes = fileStat.st_size;
+
+	void* data = mmap(nullptr, fileBytes, PROT_READ, MAP_PRIVATE, file, 0);
+	if (data != MAP_FAILED)
+		fileData = (const uint8_t*)data;
+#endif
+
+	if (fileData == nullptr)
+	{
+		Log("Unable to map world cache ", fileName);
+		Close();
+		return false;
+	}
+
+	Header header;
+	memcpy(&header, fileData, sizeof(Header));
+	Header expected = GetHeader();
+	if (memcmp(&header, &expected, offsetof(Header, payloadBytes)) != 0 ||
+		header.payloadBytes != fileBytes - HEADER_BYTES ||
+		UpdateChecksum(FNV_OFFSET_BASIS, fileData + HEADER_BYTES, header.payloadBytes) != header.checksum)
+	{
+		Log("World cache ", fileName, " is stale");
+		Close();
+		return false;
+	}
+
+	readOffset = HEADER_BYTES;
+	TouchWorldFile(fileName);
+	return true;
+}
+
+const uint8_t* WorldCache::Read(const uint64_t bytes)
+{
+	uint64_t paddedBytes = (bytes + 7) & ~uint64_t(7);
+	if (fileData == nullptr || readOffset + paddedBytes > fileBytes)
+		return nullptr;
+
+	const uint8_t* data = fileData + readOffset;
+	readOffset += paddedBytes;
+	return data;
+}
+
+void WorldCache::Close()
+{
+#ifdef _WIN32
+	if (fileData != nullptr)
+		Windows::UnmapViewOfFile(fileData);
+	if (mapping != nullptr)
+		Windows::CloseHandle(mapping);
+	if (file != nullptr)
+		Windows::CloseHandle(file);
+	mapping = nullptr;
+	file = nullptr;
+#else
+	if (fileData != nullptr)
+		munmap((void*)fileData, fileBytes);
+	if (file >= 0)
+		close(file);
+	file = -1;
+#endif
+	fileData = nullptr;
+	fileBytes = 0;
+	readOffset = 0;
+}
+
+bool WorldCache::BeginWrite()
+{
+	outputFile.open(fileName, std::ios::binary | std::ios::trunc);
+	if (outputFile.fail())
+	{
+		Log("Unable to write world cache ", fileName);
+		return false;
+	}
+
+	// The header is zeroed until the whole file is written, so the unfinished file is stale
+	const char zeros[HEADER_BYTES] = {};
+	outputFile.write(zeros, HEADER_BYTES);
+	writtenBytes = 0;
+	writeChecksum = FNV_OFFSET_BASIS;
+	return true;
+}
+
+void WorldCache::Write(const void* data, const uint64_t bytes)
+{
+	const char zeros[8] = {};
+	uint64_t paddedBytes = (bytes + 7) & ~uint64_t(7);
+	outputFile.write((const char*)data, bytes);
+	outputFile.write(zeros, paddedBytes - bytes);
+	writtenBytes += paddedBytes;
+	writeChecksum = UpdateChecksum(writeChecksum, (const uint8_t*)data, bytes);
+}
+
+bool WorldCache::EndWrite()
+{
+	Header header = GetHeader();
+	header.payloadBytes = writtenBytes;
+	header.checksum = writeChecksum;
+	outputFile.seekp(0);
+	outputFile.write((const char*)&header, sizeof(header));
+	outputFile.close();
+
+	if (outputFile.fail())
+	{
+		Log("Unable to write world cache ", fileName);
+		std::remove(fileName.c_str());
+		return false;
+	}
+
+	RemoveOldWorldFiles(fileName);
+	return true;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <Utils.h>
+
+#include <string>
+#include <fstream>
+#include <cstring>
+
+#define WORLD_CACHE_VERSION 6
+// Every new game with a fixed seed is another world, only the most recently used ones are kept
+#define WORLD_CACHE_FILES 4
+
+// Everything the generated world depends on
+struct WorldKey
+{
+	int seed;
+	glm::ivec4 mazeSize;
+	int roomSize;
+	int lightDist;
+	int mazeAlgorithm;
+	int mazeThreads; // only for the parallel algorithm
+	int cellLayout;
+	// Hash of the random engine state before the generation, the next game with the same seed
+	// continues the random sequence and gets another world
+	uint32_t randomState;
+};
+
+// Binary file with the generated world, identified by the key. The file is a header and a sequence
+// of blocks, padded to 8 bytes, which are read in the same order as written.
+// It is read by mapping to memory, so the blocks can be used without copying.
+// A written file takes the place of the least recently used one, when there are WORLD_CACHE_FILES of them.
+class WorldCache
+{
+public:
+	WorldCache(const WorldKey& key);
+	~WorldCache();
+
+	// Maps the file and validates it, false if it is missing, written by another version or damaged
+	bool Open();
+
+	// Next block of the opened file, nullptr if the file is too short
+	const uint8_t* Read(const uint64_t bytes);
+
+	template <typename T>
+	bool ReadValue(T& value)
+	{
+		const uint8_t* data = Read(sizeof(T));
+		if (data == nullptr)
+			return false;
+		memcpy(&value, data, sizeof(T));
+		return true;
+	}
+
+	// Unmaps the file, blocks which were read are not valid anymore
+	void Close();
+
+	// Writing: blocks go after the header, which is written by EndWrite
+	bool BeginWrite();
+	void Write(const void* data, const uint64_t bytes);
+
+	template <typename T>
+	void WriteValue(const T& value)
+	{
+		Write(&value, sizeof(T));
+	}
+
+	bool EndWrite();
+
+	const std::string fileName;
+
+private:
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		WorldKey key;
+		// Cell layout
+		uint32_t brickBits;
+		uint32_t cellBytes;
+		uint32_t lightBytes;
+		uint64_t payloadBytes;
+		uint64_t checksum;
+	};
+
+	Header GetHeader();
+
+	// FNV-1a over 64-bit words
+	static uint64_t UpdateChecksum(uint64_t checksum, const uint8_t* data, const uint64_t bytes);
+
+	const WorldKey key;
+
+	// Reading
+	const uint8_t* fileData = nullptr;
+	uint64_t fileBytes = 0;
+	uint64_t readOffset = 0;
+#ifdef _WIN32
+	Windows::HANDLE file = nullptr;
+	Windows::HANDLE mapping = nullptr;
+#else
+	int file = -1;
+#endif
+
+	// Writing
+	std::ofstream outputFile;
+	uint64_t writtenBytes = 0;
+	uint64_t writeChecksum = 0;
+};
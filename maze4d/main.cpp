@@ -279,11 +279,25 @@ GLFWwindow* InitGL()
 		return nullptr;
 	}
 
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
-	GLFWwindow* window = glfwCreateWindow(windowSize.x, windowSize.y, "4D maze", NULL, NULL);
+	GLFWwindow* window = nullptr;
+	// The compute raycaster needs OpenGL 4.3, without it the game falls back to 3.3 and the fragment raycaster
+	if (game.cfg->GetInt("gpu_raycaster") == 1)
+	{
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		glfwSetErrorCallback(NULL);
+		window = glfwCreateWindow(windowSize.x, windowSize.y, "4D maze", NULL, NULL);
+		glfwSetErrorCallback(OnError);
+	}
+
+	if (!window)
+	{
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		window = glfwCreateWindow(windowSize.x, windowSize.y, "4D maze", NULL, NULL);
+	}
 	if (!window)
 	{
 		CriticalError("Window or OpenGL context creation failed");
@@ -388,9 +402,10 @@ int main()
 
 		delete[] texData;
 
+		game.DeleteScenes();
+		game.ClearShaders();
 		glfwDestroyWindow(window);
 		glfwTerminate();
-		game.ClearShaders();
 	}
 	return 0;
 }
@@ -3,6 +3,8 @@
 
 
 #include <glad/glad.h>
+#include <GLCompute.h>
+#include <ProgramCache.h>
 #include <glm/glm.hpp>
 
 #include <string>
@@ -10,6 +12,23 @@
 #include <sstream>
 #include <iostream>
 
+// Uniforms, which the game sets: their locations are resolved once, when the program is linked,
+// and the set* helpers take them by this index. See UNIFORM_NAMES
+enum SHADER_UNIFORM
+{
+	UNIFORM_CURRENT_MAP = 0,
+	UNIFORM_CURRENT_LIGHT_MAP,
+	UNIFORM_EDGE_3D_CUBE,
+	UNIFORM_LIGHT_3D_CUBE,
+	UNIFORM_ANTI_ALIASING_PASS,
+	UNIFORM_TEMPORAL_HISTORY,
+	UNIFORM_TEMPORAL_JITTER,
+	UNIFORM_HIT_MAP,
+	UNIFORM_HISTORY_MAP,
+	UNIFORM_HISTORY_HIT_MAP,
+	UNIFORM_COUNT
+};
+
 class Shader
 {
 public:
@@ -21,8 +40,19 @@ public:
 		GenerateShader(vertexCode, fragmentCode);		
 	}
 
-	void GenerateShader(const char* vertexCode, const char* fragmentCode)
+	// name is the name of the program in the ProgramCache
+	void GenerateShader(const char* vertexCode, const char* fragmentCode, const std::string& name = "program")
 	{
+		// 0. the program, which was linked by the previous launch
+		ProgramCache* cache = ProgramCache::GetInstance();
+		uint64_t key = cache->GetKey(vertexCode, fragmentCode);
+		ID = glCreateProgram();
+		if (cache->LoadProgram(ID, name, key))
+		{
+			LoadUniformLocations();
+			return;
+		}
+
 		// 1. compile shaders
 		unsigned int vertex, fragment;
 
@@ -39,11 +69,13 @@ public:
 		checkCompileErrors(fragment, "FRAGMENT");
 
 		// shader Program
-		ID = glCreateProgram();
 		glAttachShader(ID, vertex);
 		glAttachShader(ID, fragment);
+		cache->PrepareLink(ID);
 		glLinkProgram(ID);
 		checkCompileErrors(ID, "PROGRAM");
+		cache->SaveProgram(ID, name, key);
+		LoadUniformLocations();
 
 		// delete the shaders as they're linked into our program now and no longer necessery
 		glDeleteShader(vertex);
@@ -66,7 +98,45 @@ public:
 		std::string FragmentString(sstream1.str());
 		const char* Fptr = FragmentString.c_str();
 
-		GenerateShader(Vptr, Fptr);
+		GenerateShader(Vptr, Fptr, GetProgramName(fragmentFile));
+	}
+
+	// Compute shader (GL 4.3) from the file, its #version line is replaced by the GL 4.3 one and the header,
+	// e.g. the defines, which turn the fragment raycaster into the compute one
+	void LoadComputeFromFile(std::string computeFile, std::string header = "")
+	{
+		std::ifstream fs(computeFile);
+		std::ostringstream sstream;
+		sstream << fs.rdbuf();
+		std::string ComputeString(sstream.str());
+		if (ComputeString.compare(0, 8, "#version") == 0)
+			ComputeString.erase(0, ComputeString.find('\n') + 1);
+		ComputeString = "#version 430 core\n" + header + ComputeString;
+		const char* Cptr = ComputeString.c_str();
+
+		ProgramCache* cache = ProgramCache::GetInstance();
+		uint64_t key = cache->GetKey(ComputeString);
+		std::string name = GetProgramName(computeFile) + "_compute";
+		ID = glCreateProgram();
+		if (cache->LoadProgram(ID, name, key))
+		{
+			LoadUniformLocations();
+			return;
+		}
+
+		unsigned int compute = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(compute, 1, &Cptr, NULL);
+		glCompileShader(compute);
+		checkCompileErrors(compute, "COMPUTE");
+
+		glAttachShader(ID, compute);
+		cache->PrepareLink(ID);
+		glLinkProgram(ID);
+		checkCompileErrors(ID, "PROGRAM");
+		cache->SaveProgram(ID, name, key);
+		LoadUniformLocations();
+
+		glDeleteShader(compute);
 	}
 
 	// activate the shader
@@ -76,66 +146,117 @@ public:
 		
 		glUseProgram(ID);
 	}
+	// location of the uniform, which is resolved at link time; -1 if the program has no such uniform
+	// (then glUniform* ignores it)
+	GLint GetUniformLocation(SHADER_UNIFORM uniform) const
+	{
+		return uniformLocations[uniform];
+	}
+
+	// connects the uniform block of the program to the buffer binding point
+	void BindUniformBlock(const char* name, GLuint binding) const
+	{
+		GLuint index = glGetUniformBlockIndex(ID, name);
+		if (index != GL_INVALID_INDEX)
+			glUniformBlockBinding(ID, index, binding);
+	}
+
 	// utility uniform functions
 	// ------------------------------------------------------------------------
-	void setBool(const std::string &name, bool value) const
+	void setBool(SHADER_UNIFORM uniform, bool value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		glUniform1i(uniformLocations[uniform], (int)value);
 	}
 	// ------------------------------------------------------------------------
-	void setInt(const std::string &name, int value) const
+	void setInt(SHADER_UNIFORM uniform, int value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		glUniform1i(uniformLocations[uniform], value);
+	}
+	void setIntArray(SHADER_UNIFORM uniform, int count, const int* values) const
+	{
+		glUniform1iv(uniformLocations[uniform], count, values);
 	}
 	// ------------------------------------------------------------------------
-	void setFloat(const std::string &name, float value) const
+	void setFloat(SHADER_UNIFORM uniform, float value) const
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		glUniform1f(uniformLocations[uniform], value);
 	}
 	// ------------------------------------------------------------------------
-	void setVec2(const std::string &name, const glm::vec2 &value) const
+	void setVec2(SHADER_UNIFORM uniform, const glm::vec2 &value) const
 	{
-		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform2fv(uniformLocations[uniform], 1, &value[0]);
 	}
-	void setVec2(const std::string &name, float x, float y) const
+	void setVec2(SHADER_UNIFORM uniform, float x, float y) const
 	{
-		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+		glUniform2f(uniformLocations[uniform], x, y);
 	}
 	// ------------------------------------------------------------------------
-	void setVec3(const std::string &name, const glm::vec3 &value) const
+	void setVec3(SHADER_UNIFORM uniform, const glm::vec3 &value) const
 	{
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform3fv(uniformLocations[uniform], 1, &value[0]);
 	}
-	void setVec3(const std::string &name, float x, float y, float z) const
+	void setVec3(SHADER_UNIFORM uniform, float x, float y, float z) const
 	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+		glUniform3f(uniformLocations[uniform], x, y, z);
 	}
 	// ------------------------------------------------------------------------
-	void setVec4(const std::string &name, const glm::vec4 &value) const
+	void setVec4(SHADER_UNIFORM uniform, const glm::vec4 &value) const
 	{
-		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform4fv(uniformLocations[uniform], 1, &value[0]);
 	}
-	void setVec4(const std::string &name, float x, float y, float z, float w)
+	void setVec4(SHADER_UNIFORM uniform, float x, float y, float z, float w)
 	{
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+		glUniform4f(uniformLocations[uniform], x, y, z, w);
 	}
 	// ------------------------------------------------------------------------
-	void setMat2(const std::string &name, const glm::mat2 &mat) const
+	void setMat2(SHADER_UNIFORM uniform, const glm::mat2 &mat) const
 	{
-		glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniformMatrix2fv(uniformLocations[uniform], 1, GL_FALSE, &mat[0][0]);
 	}
 	// ------------------------------------------------------------------------
-	void setMat3(const std::string &name, const glm::mat3 &mat) const
+	void setMat3(SHADER_UNIFORM uniform, const glm::mat3 &mat) const
 	{
-		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniformMatrix3fv(uniformLocations[uniform], 1, GL_FALSE, &mat[0][0]);
 	}
 	// ------------------------------------------------------------------------
-	void setMat4(const std::string &name, const glm::mat4 &mat) const
+	void setMat4(SHADER_UNIFORM uniform, const glm::mat4 &mat) const
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniformMatrix4fv(uniformLocations[uniform], 1, GL_FALSE, &mat[0][0]);
 	}
 
 private:
+	// Name of the program of the file: the file name without the path and the extension
+	static std::string GetProgramName(const std::string& fileName)
+	{
+		size_t begin = fileName.find_last_of("/\\");
+		begin = begin == std::string::npos ? 0 : begin + 1;
+		size_t end = fileName.find_last_of('.');
+		return fileName.substr(begin, end == std::string::npos || end < begin ? std::string::npos : end - begin);
+	}
+
+	// The driver looks the names up by strings, so it is done once for all the uniforms of the game.
+	// An array is found by its name
+	void LoadUniformLocations()
+	{
+		static const char* UNIFORM_NAMES[UNIFORM_COUNT] = {
+			"currentMap",
+			"currentLightMap",
+			"edge3dCube",
+			"light3dCube",
+			"AntiAliasingPass",
+			"TemporalHistory",
+			"TemporalJitter",
+			"hitMap",
+			"historyMap",
+			"historyHitMap"
+		};
+
+		for (int u = 0; u < UNIFORM_COUNT; u++)
+			uniformLocations[u] = glGetUniformLocation(ID, UNIFORM_NAMES[u]);
+	}
+
+	GLint uniformLocations[UNIFORM_COUNT] = {};
+
 	// utility function for checking shader compilation/linking errors.
 	// ------------------------------------------------------------------------
 	void checkCompileErrors(GLuint shader, std::string type)